@@ -0,0 +1,48 @@
+#include "blocking_pool.h"
+
+namespace sylar
+{
+
+    BlockingPool *BlockingPool::GetInstance()
+    {
+        // 不析构 -> 进程退出时线程可能仍阻塞在任务中
+        static BlockingPool *pool = new BlockingPool();
+        return pool;
+    }
+
+    void BlockingPool::submit(std::function<void()> task)
+    {
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_threads.empty())
+            {
+                for (size_t i = 0; i < std::max<size_t>(1, m_threadCount); ++i)
+                {
+                    m_threads.emplace_back(new Thread(std::bind(&BlockingPool::run, this), "blocking_" + std::to_string(i)));
+                }
+            }
+            m_tasks.push_back(std::move(task));
+        }
+        m_sem.signal();
+    }
+
+    void BlockingPool::run()
+    {
+        // 没有调度器 -> 钩子未启用，任务中的阻塞调用直接进入内核
+        while (true)
+        {
+            m_sem.wait();
+
+            std::function<void()> task;
+            {
+                RuntimeScope scope;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                task.swap(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+}
@@ -0,0 +1,93 @@
+#ifndef _BLOCKING_POOL_H_
+#define _BLOCKING_POOL_H_
+
+#include "fiber_sync.h"
+
+#include <cerrno>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <type_traits>
+
+namespace sylar
+{
+
+    // 阻塞调用线程池：运行钩子无法挂起的阻塞调用(普通文件IO、getaddrinfo、第三方库)，不占用调度器的工作线程
+    class BlockingPool
+    {
+    public:
+        static BlockingPool *GetInstance();
+
+        // 线程在第一次submit()时创建，之前调用才生效
+        void setThreadCount(size_t count) { m_threadCount = count; }
+        size_t getThreadCount() const { return m_threadCount; }
+
+        void submit(std::function<void()> task);
+
+    private:
+        BlockingPool() = default;
+
+        void run();
+
+    private:
+        size_t m_threadCount = 4;
+        std::mutex m_mutex;
+        std::deque<std::function<void()>> m_tasks;
+        // 任务数
+        Semaphore m_sem;
+        std::vector<std::shared_ptr<Thread>> m_threads;
+    };
+
+    // 在阻塞线程池中运行fn并返回其结果，fn抛出的异常在调用方重新抛出，errno也带回调用方
+    // 在调度的协程中 -> 挂起当前协程直到fn完成；否则 -> 直接在当前线程调用
+    template <typename Fn>
+    auto await_blocking(Fn fn) -> decltype(fn())
+    {
+        using R = decltype(fn());
+
+        if (!FiberWaiter::CanPark())
+        {
+            return fn();
+        }
+
+        // 结果保存在当前协程的栈上，wake()之后不再访问
+        std::conditional_t<std::is_void<R>::value, bool, std::optional<R>> result;
+        std::exception_ptr error;
+        int saved_errno = 0;
+        FiberWaiter waiter;
+
+        BlockingPool::GetInstance()->submit([&]()
+                                            {
+            try
+            {
+                if constexpr (std::is_void<R>::value)
+                {
+                    fn();
+                }
+                else
+                {
+                    result.emplace(fn());
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            saved_errno = errno;
+            waiter.wake(); });
+        waiter.wait();
+
+        errno = saved_errno;
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        if constexpr (!std::is_void<R>::value)
+        {
+            return std::move(*result);
+        }
+    }
+
+}
+
+#endif
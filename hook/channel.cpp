@@ -0,0 +1,114 @@
+#include "channel.h"
+#include "ioscheduler.h"
+
+namespace sylar
+{
+
+    int Select::wait(uint64_t timeout_ms)
+    {
+        assert(!m_cases.empty() || timeout_ms != (uint64_t)-1);
+
+        RuntimeScope scope;
+        // 按地址顺序加锁 -> 多个select之间不会死锁
+        std::vector<std::mutex *> mutexes;
+        for (auto &c : m_cases)
+        {
+            mutexes.push_back(c->mutex());
+        }
+        std::sort(mutexes.begin(), mutexes.end());
+        mutexes.erase(std::unique(mutexes.begin(), mutexes.end()), mutexes.end());
+
+        auto lock_all = [&mutexes]()
+        {
+            for (std::mutex *m : mutexes)
+            {
+                m->lock();
+            }
+        };
+        auto unlock_all = [&mutexes]()
+        {
+            for (auto it = mutexes.rbegin(); it != mutexes.rend(); ++it)
+            {
+                (*it)->unlock();
+            }
+        };
+
+        // 1 逐个尝试
+        lock_all();
+        for (size_t i = 0; i < m_cases.size(); ++i)
+        {
+            ChannelSelector *wake = nullptr;
+            if (m_cases[i]->tryLocked(&wake))
+            {
+                unlock_all();
+                if (wake)
+                {
+                    wake->waiter.wake();
+                }
+                return (int)i;
+            }
+        }
+
+        if (timeout_ms == 0)
+        {
+            unlock_all();
+            return -1;
+        }
+
+        // 2 挂到所有通道上 -> 持有全部锁时没有人能认领它
+        std::shared_ptr<ChannelSelector> sel = std::make_shared<ChannelSelector>();
+        CancelWait cancel_wait([&sel]()
+                               { cancelSelector(sel.get()); });
+        if (cancel_wait.cancelled())
+        {
+            unlock_all();
+            errno = ECANCELED;
+            return -1;
+        }
+        for (size_t i = 0; i < m_cases.size(); ++i)
+        {
+            m_cases[i]->enqueueLocked(sel.get(), (int)i);
+        }
+        unlock_all();
+
+        // 超时由定时器认领，定时器只持有弱引用
+        std::shared_ptr<Timer> timer;
+        if (timeout_ms != (uint64_t)-1)
+        {
+            IOManager *iom = IOManager::GetThis();
+            assert(iom != nullptr);
+            std::weak_ptr<ChannelSelector> weak(sel);
+            timer = iom->addTimer(timeout_ms, [weak]()
+                                  {
+                std::shared_ptr<ChannelSelector> s = weak.lock();
+                if (s && s->claim(ChannelSelector::TIMEOUT))
+                {
+                    s->waiter.wake();
+                } });
+        }
+
+        // 3 挂起，直到某个通道或定时器认领
+        sel->waiter.wait();
+        if (timer)
+        {
+            timer->cancel();
+        }
+
+        // 4 从其他通道上摘下
+        lock_all();
+        for (auto &c : m_cases)
+        {
+            c->dequeueLocked();
+        }
+        unlock_all();
+
+        int fired = sel->fired;
+        if (fired == ChannelSelector::CANCELLED)
+        {
+            errno = ECANCELED;
+            return -1;
+        }
+        return fired == ChannelSelector::TIMEOUT ? -1 : fired;
+    }
+
+}
@@ -0,0 +1,441 @@
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include "fiber_sync.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace sylar
+{
+
+    // 一次收发/select的等待状态：挂在多个通道上时只有一个通道(或超时)能认领它
+    struct ChannelSelector
+    {
+        static constexpr int NONE = -1;
+        static constexpr int TIMEOUT = -2;
+        static constexpr int CANCELLED = -3;
+
+        // 被认领的case下标
+        std::atomic<int> fired = {NONE};
+        FiberWaiter waiter;
+
+        bool claim(int index)
+        {
+            int expected = NONE;
+            return fired.compare_exchange_strong(expected, index);
+        }
+    };
+
+    // 取消令牌的唤醒函数：认领成功才唤醒，对端会跳过已被认领的等待者
+    inline void cancelSelector(ChannelSelector *sel)
+    {
+        if (sel->claim(ChannelSelector::CANCELLED))
+        {
+            sel->waiter.wake();
+        }
+    }
+
+    // select的一个分支，持有对应通道的锁时才能调用
+    class SelectCase
+    {
+    public:
+        virtual ~SelectCase() {}
+
+        virtual std::mutex *mutex() = 0;
+        // 尝试立即完成，*wake为解锁之后需要唤醒的对端
+        virtual bool tryLocked(ChannelSelector **wake) = 0;
+        virtual void enqueueLocked(ChannelSelector *sel, int index) = 0;
+        virtual void dequeueLocked() = 0;
+
+        // 发送成功/收到值为true，通道已关闭为false
+        bool ok = false;
+    };
+
+    // 通道：协程间传递数据，满/空时挂起当前协程
+    // capacity == 0 -> 无缓冲，收发双方直接交接；capacity == UNBOUNDED -> 发送永不挂起
+    template <typename T>
+    class Channel
+    {
+    public:
+        static constexpr size_t UNBOUNDED = SIZE_MAX;
+
+        explicit Channel(size_t capacity = 0) : m_capacity(capacity) {}
+        Channel(const Channel &) = delete;
+        Channel &operator=(const Channel &) = delete;
+
+        // 通道关闭时返回false，协程的取消令牌被取消时也返回false且errno为ECANCELED
+        bool send(T value)
+        {
+            RuntimeScope scope;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool ok = false;
+            ChannelSelector *wake = nullptr;
+            if (trySendLocked(value, ok, &wake))
+            {
+                lock.unlock();
+                if (wake)
+                {
+                    wake->waiter.wake();
+                }
+                return ok;
+            }
+
+            ChannelSelector sel;
+            Waiter waiter{&sel, 0, &value, &ok};
+            CancelWait cancel_wait([&sel]()
+                                   { cancelSelector(&sel); });
+            if (cancel_wait.cancelled())
+            {
+                errno = ECANCELED;
+                return false;
+            }
+            m_sendq.push_back(&waiter);
+            // 对端出队并认领之后才会唤醒
+            sel.waiter.wait(lock);
+            return finishWait(sel, m_sendq, &waiter, ok);
+        }
+
+        // 通道已关闭且没有数据时返回false，取消时同send()
+        bool recv(T &out)
+        {
+            RuntimeScope scope;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool ok = false;
+            ChannelSelector *wake = nullptr;
+            if (tryRecvLocked(out, ok, &wake))
+            {
+                lock.unlock();
+                if (wake)
+                {
+                    wake->waiter.wake();
+                }
+                return ok;
+            }
+
+            ChannelSelector sel;
+            Waiter waiter{&sel, 0, &out, &ok};
+            CancelWait cancel_wait([&sel]()
+                                   { cancelSelector(&sel); });
+            if (cancel_wait.cancelled())
+            {
+                errno = ECANCELED;
+                return false;
+            }
+            m_recvq.push_back(&waiter);
+            sel.waiter.wait(lock);
+            return finishWait(sel, m_recvq, &waiter, ok);
+        }
+
+        // 不挂起，只有成功时才取走value
+        bool trySend(T &value)
+        {
+            RuntimeScope scope;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool ok = false;
+            ChannelSelector *wake = nullptr;
+            if (!trySendLocked(value, ok, &wake))
+            {
+                return false;
+            }
+            lock.unlock();
+            if (wake)
+            {
+                wake->waiter.wake();
+            }
+            return ok;
+        }
+
+        bool tryRecv(T &out)
+        {
+            RuntimeScope scope;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool ok = false;
+            ChannelSelector *wake = nullptr;
+            if (!tryRecvLocked(out, ok, &wake))
+            {
+                return false;
+            }
+            lock.unlock();
+            if (wake)
+            {
+                wake->waiter.wake();
+            }
+            return ok;
+        }
+
+        // 唤醒所有等待者，之后发送失败，接收取完缓冲区后失败
+        void close()
+        {
+            std::vector<ChannelSelector *> wakes;
+            {
+                RuntimeScope scope;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_closed)
+                {
+                    return;
+                }
+                m_closed = true;
+
+                Waiter *waiter = nullptr;
+                while ((waiter = popClaimed(m_recvq)) != nullptr)
+                {
+                    *waiter->ok = false;
+                    wakes.push_back(waiter->sel);
+                }
+                while ((waiter = popClaimed(m_sendq)) != nullptr)
+                {
+                    *waiter->ok = false;
+                    wakes.push_back(waiter->sel);
+                }
+            }
+            for (ChannelSelector *sel : wakes)
+            {
+                sel->waiter.wake();
+            }
+        }
+
+        bool isClosed()
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_closed;
+        }
+
+        size_t size()
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_buffer.size();
+        }
+
+        size_t capacity() const { return m_capacity; }
+
+    private:
+        // 挂起的收发方，slot指向等待者栈上的值
+        struct Waiter
+        {
+            ChannelSelector *sel;
+            int index;
+            T *slot;
+            bool *ok;
+        };
+
+        template <typename U>
+        friend class SendCase;
+        template <typename U>
+        friend class RecvCase;
+
+        // no lock，跳过已经在别的通道被认领的select等待者
+        static Waiter *popClaimed(std::deque<Waiter *> &q)
+        {
+            while (!q.empty())
+            {
+                Waiter *waiter = q.front();
+                q.pop_front();
+                if (waiter->sel->claim(waiter->index))
+                {
+                    return waiter;
+                }
+            }
+            return nullptr;
+        }
+
+        // no lock
+        bool trySendLocked(T &value, bool &ok, ChannelSelector **wake)
+        {
+            if (m_closed)
+            {
+                ok = false;
+                return true;
+            }
+
+            // 有接收方在等 -> 直接交给它
+            if (Waiter *waiter = popClaimed(m_recvq))
+            {
+                *waiter->slot = std::move(value);
+                *waiter->ok = true;
+                *wake = waiter->sel;
+                ok = true;
+                return true;
+            }
+
+            if (m_buffer.size() < m_capacity)
+            {
+                m_buffer.push_back(std::move(value));
+                ok = true;
+                return true;
+            }
+            return false;
+        }
+
+        // no lock
+        bool tryRecvLocked(T &out, bool &ok, ChannelSelector **wake)
+        {
+            if (!m_buffer.empty())
+            {
+                out = std::move(m_buffer.front());
+                m_buffer.pop_front();
+                ok = true;
+
+                // 腾出了位置 -> 挂起的发送方可以放入缓冲区
+                if (Waiter *waiter = popClaimed(m_sendq))
+                {
+                    m_buffer.push_back(std::move(*waiter->slot));
+                    *waiter->ok = true;
+                    *wake = waiter->sel;
+                }
+                return true;
+            }
+
+            // 无缓冲 -> 直接从发送方取
+            if (Waiter *waiter = popClaimed(m_sendq))
+            {
+                out = std::move(*waiter->slot);
+                *waiter->ok = true;
+                *wake = waiter->sel;
+                ok = true;
+                return true;
+            }
+
+            if (m_closed)
+            {
+                ok = false;
+                return true;
+            }
+            return false;
+        }
+
+        // no lock
+        static void remove(std::deque<Waiter *> &q, Waiter *waiter)
+        {
+            auto it = std::find(q.begin(), q.end(), waiter);
+            if (it != q.end())
+            {
+                q.erase(it);
+            }
+        }
+
+        // 被取消令牌认领 -> 还在队列中，自己摘下
+        bool finishWait(ChannelSelector &sel, std::deque<Waiter *> &q, Waiter *waiter, bool ok)
+        {
+            if (sel.fired != ChannelSelector::CANCELLED)
+            {
+                return ok;
+            }
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            remove(q, waiter);
+            errno = ECANCELED;
+            return false;
+        }
+
+    private:
+        std::mutex m_mutex;
+        size_t m_capacity;
+        bool m_closed = false;
+        std::deque<T> m_buffer;
+        // 挂起的接收方/发送方
+        std::deque<Waiter *> m_recvq;
+        std::deque<Waiter *> m_sendq;
+    };
+
+    template <typename T>
+    class SendCase : public SelectCase
+    {
+    public:
+        SendCase(Channel<T> &ch, T value) : m_ch(ch), m_value(std::move(value)) {}
+
+        std::mutex *mutex() override { return &m_ch.m_mutex; }
+
+        bool tryLocked(ChannelSelector **wake) override
+        {
+            return m_ch.trySendLocked(m_value, ok, wake);
+        }
+
+        void enqueueLocked(ChannelSelector *sel, int index) override
+        {
+            m_waiter = {sel, index, &m_value, &ok};
+            m_ch.m_sendq.push_back(&m_waiter);
+        }
+
+        void dequeueLocked() override
+        {
+            Channel<T>::remove(m_ch.m_sendq, &m_waiter);
+        }
+
+    private:
+        Channel<T> &m_ch;
+        T m_value;
+        typename Channel<T>::Waiter m_waiter;
+    };
+
+    template <typename T>
+    class RecvCase : public SelectCase
+    {
+    public:
+        RecvCase(Channel<T> &ch, T &out) : m_ch(ch), m_out(out) {}
+
+        std::mutex *mutex() override { return &m_ch.m_mutex; }
+
+        bool tryLocked(ChannelSelector **wake) override
+        {
+            return m_ch.tryRecvLocked(m_out, ok, wake);
+        }
+
+        void enqueueLocked(ChannelSelector *sel, int index) override
+        {
+            m_waiter = {sel, index, &m_out, &ok};
+            m_ch.m_recvq.push_back(&m_waiter);
+        }
+
+        void dequeueLocked() override
+        {
+            Channel<T>::remove(m_ch.m_recvq, &m_waiter);
+        }
+
+    private:
+        Channel<T> &m_ch;
+        T &m_out;
+        typename Channel<T>::Waiter m_waiter;
+    };
+
+    // 在多个通道上等待，第一个能完成的分支生效，一个Select对象只wait()一次
+    // work flow
+    // 1 锁住所有通道并逐个尝试 -> 2 都不能完成则挂到所有通道上 -> 3 解锁并挂起 -> 4 被唤醒后从所有通道上摘下
+    class Select
+    {
+    public:
+        template <typename T>
+        Select &send(Channel<T> &ch, T value)
+        {
+            m_cases.emplace_back(new SendCase<T>(ch, std::move(value)));
+            return *this;
+        }
+
+        template <typename T>
+        Select &recv(Channel<T> &ch, T &out)
+        {
+            m_cases.emplace_back(new RecvCase<T>(ch, out));
+            return *this;
+        }
+
+        // 返回完成的分支下标(按添加顺序)，超时返回-1，取消时返回-1且errno为ECANCELED
+        // timeout_ms: -1 -> 一直等待，0 -> 不挂起；其他超时需要运行在IOManager上
+        int wait(uint64_t timeout_ms = (uint64_t)-1);
+
+        // 分支是否成功：发送成功/收到值为true，通道已关闭为false
+        bool ok(int index) const { return m_cases[index]->ok; }
+
+    private:
+        std::vector<std::unique_ptr<SelectCase>> m_cases;
+    };
+
+}
+
+#endif
@@ -22,6 +22,26 @@ namespace sylar
         init();
     }
 
+    FdCtx::FdCtx(int fd, bool nonblock_socket) : m_fd(fd)
+    {
+        if (!nonblock_socket)
+        {
+            init();
+            return;
+        }
+
+        m_isInit = true;
+        m_isSocket = true;
+        m_sysNonblock = true;
+    }
+
+    FdCtx::FdCtx(int fd, const FdCtx &other)
+        : m_isInit(other.m_isInit), m_isSocket(other.m_isSocket), m_isFile(other.m_isFile), m_sysNonblock(other.m_sysNonblock),
+          m_userNonblock(other.m_userNonblock), m_isDup(true), m_fd(fd), m_recvTimeout(other.m_recvTimeout), m_sendTimeout(other.m_sendTimeout)
+    {
+        // the kernel numbers zero-copy sends per socket, which other's fd shares -> no zero-copy here, see enableZeroCopy()
+    }
+
     FdCtx::~FdCtx()
     {
     }
@@ -44,6 +64,7 @@ namespace sylar
         {
             m_isInit = true;
             m_isSocket = S_ISSOCK(statbuf.st_mode);
+            m_isFile = S_ISREG(statbuf.st_mode) || S_ISBLK(statbuf.st_mode);
         }
 
         // if it is a socket -> set to nonblock
@@ -56,6 +77,11 @@ namespace sylar
                 // if not -> set to nonblock
                 fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
             }
+            else
+            {
+                // a socket the hooks didn't create (socketpair(), before set_hook_enable()) -> its owner chose nonblocking itself
+                m_userNonblock = true;
+            }
             m_sysNonblock = true;
         }
         else
@@ -90,6 +116,39 @@ namespace sylar
         }
     }
 
+    bool FdCtx::enableZeroCopy()
+    {
+        if (m_zeroCopy)
+        {
+            return true;
+        }
+        if (!m_isSocket || m_isDup)
+        {
+            return false;
+        }
+
+        int one = 1;
+        if (setsockopt_f(m_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+        {
+            return false;
+        }
+        m_zeroCopy = true;
+        return true;
+    }
+
+    ssize_t FdCtx::sendZeroCopy(const struct msghdr *msg, int flags, uint32_t &seq)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_zcMutex);
+        ssize_t n = sendmsg_f(m_fd, msg, flags | MSG_ZEROCOPY);
+        // the kernel only numbers sends that queued data
+        if (n > 0)
+        {
+            seq = m_zcSeq++;
+        }
+        return n;
+    }
+
     FdManager::FdManager()
     {
         m_datas.resize(64);
@@ -97,13 +156,14 @@ namespace sylar
 
     std::shared_ptr<FdCtx> FdManager::get(int fd, bool auto_create)
     {
-        if (fd == -1)
+        if (fd < 0)
         {
             return nullptr;
         }
+        size_t index = fd;
 
         std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-        if (m_datas.size() <= fd)
+        if (m_datas.size() <= index)
         {
             if (auto_create == false)
             {
@@ -121,7 +181,7 @@ namespace sylar
         read_lock.unlock();
         std::unique_lock<std::shared_mutex> write_lock(m_mutex);
 
-        if (m_datas.size() <= fd)
+        if (m_datas.size() <= index)
         {
             m_datas.resize(fd * 1.5);
         }
@@ -130,13 +190,63 @@ namespace sylar
         return m_datas[fd];
     }
 
+    std::shared_ptr<FdCtx> FdManager::addSocket(int fd, bool user_nonblock)
+    {
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        size_t index = fd;
+
+        std::shared_ptr<FdCtx> ctx = m_probeSockets ? std::make_shared<FdCtx>(fd) : std::make_shared<FdCtx>(fd, true);
+        ctx->setUserNonblock(user_nonblock);
+
+        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+        if (m_datas.size() <= index)
+        {
+            m_datas.resize(fd * 1.5);
+        }
+        m_datas[fd] = ctx;
+        return ctx;
+    }
+
     void FdManager::del(int fd)
     {
+        if (fd < 0)
+        {
+            return;
+        }
+        size_t index = fd;
+
         std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-        if (m_datas.size() <= fd)
+        if (m_datas.size() <= index)
         {
             return;
         }
         m_datas[fd].reset();
     }
+
+    std::shared_ptr<FdCtx> FdManager::dup(int oldfd, int newfd)
+    {
+        if (newfd < 0)
+        {
+            return nullptr;
+        }
+        size_t index = newfd;
+
+        std::shared_ptr<FdCtx> old = get(oldfd);
+        std::shared_ptr<FdCtx> ctx = old ? std::make_shared<FdCtx>(newfd, *old) : nullptr;
+
+        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+        if (m_datas.size() <= index)
+        {
+            if (!ctx)
+            {
+                return nullptr;
+            }
+            m_datas.resize(newfd * 1.5 + 1);
+        }
+        m_datas[newfd] = ctx;
+        return ctx;
+    }
 } // namespace sylar
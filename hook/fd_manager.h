@@ -2,8 +2,12 @@
 #define _FD_MANAGER_H_
 
 #include "thread.h"
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <sys/socket.h>
+#include <vector>
 
 namespace sylar
 {
@@ -13,11 +17,17 @@ namespace sylar
 
     public:
         FdCtx(int fd);
+        // the caller created fd as a socket with SOCK_NONBLOCK -> no fstat/fcntl needed
+        FdCtx(int fd, bool nonblock_socket);
+        // fd is a duplicate of other's fd -> same open file, same nonblocking and timeout state
+        FdCtx(int fd, const FdCtx &other);
         ~FdCtx();
 
         bool init();
         bool isInit() const { return m_isInit; }
         bool isSocket() const { return m_isSocket; }
+        // regular file or block device -> never reported ready by epoll
+        bool isFile() const { return m_isFile; }
         bool isClosed() const { return m_isClosed; }
 
         void setUserNonblock(bool v)
@@ -32,14 +42,30 @@ namespace sylar
         void setTimeout(int type, uint64_t v);
         uint64_t getTimeout(int type);
 
+        // enable SO_ZEROCOPY once per socket
+        // false on a duplicated fd: the kernel numbers zero-copy sends per socket, shared with the original fd,
+        // while the sequence counter and the completion waiters are per fd -> a duplicate sends by copying
+        bool enableZeroCopy();
+        // sendmsg_f with MSG_ZEROCOPY, seq <- the kernel's number for it when data was queued
+        // sending and numbering under one lock -> concurrent senders can't swap numbers
+        ssize_t sendZeroCopy(const struct msghdr *msg, int flags, uint32_t &seq);
+
     private:
         bool m_isInit = false;
         bool m_isSocket = false;
+        bool m_isFile = false;
         bool m_sysNonblock = false;
         bool m_userNonblock = false;
         bool m_isClosed = false;
+        bool m_zeroCopy = false;
+        // created by dup()/dup2()/F_DUPFD from a tracked fd
+        bool m_isDup = false;
         int m_fd;
 
+        // MSG_ZEROCOPY sends issued so far, mirrors the kernel counter
+        uint32_t m_zcSeq = 0;
+        std::mutex m_zcMutex;
+
         // read event timeout
         uint64_t m_recvTimeout = (uint64_t)-1;
         // write event timeout
@@ -52,11 +78,18 @@ namespace sylar
         FdManager();
 
         std::shared_ptr<FdCtx> get(int fd, bool auto_create = false);
+        // register a socket created with SOCK_NONBLOCK, user_nonblock -> the caller asked for it
+        std::shared_ptr<FdCtx> addSocket(int fd, bool user_nonblock = false);
+        // true -> addSocket() probes the fd with fstat/fcntl like get(fd, true), only to benchmark the two paths (see main.cpp)
+        void setProbeSockets(bool v) { m_probeSockets = v; }
         void del(int fd);
+        // newfd was duplicated from oldfd -> inherit its FdCtx, or drop a stale one if oldfd isn't tracked
+        std::shared_ptr<FdCtx> dup(int oldfd, int newfd);
 
     private:
         std::shared_mutex m_mutex;
         std::vector<std::shared_ptr<FdCtx>> m_datas;
+        std::atomic<bool> m_probeSockets = {false};
     };
 
     template <typename T>
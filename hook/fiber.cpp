@@ -114,6 +114,10 @@ namespace sylar
 
 		m_state = READY;
 		m_cb = cb;
+		m_hookedLocks = 0;
+		m_runtimeDepth = 0;
+		m_deadline = (uint64_t)-1;
+		m_cancelToken.reset();
 
 		if (getcontext(&m_ctx))
 		{
@@ -144,10 +148,12 @@ namespace sylar
 		}
 		else
 		{
+			// 记录恢复它的协程
+			m_caller = t_fiber ? t_fiber : GetThis().get();
 			SetThis(this);
-			if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
+			if (swapcontext(&(m_caller->m_ctx), &m_ctx))
 			{
-				std::cerr << "resume() to t_thread_fiber failed\n";
+				std::cerr << "resume() to caller fiber failed\n";
 				pthread_exit(NULL);
 			}
 		}
@@ -173,10 +179,10 @@ namespace sylar
 		}
 		else
 		{
-			SetThis(t_thread_fiber.get());
-			if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)))
+			SetThis(m_caller);
+			if (swapcontext(&m_ctx, &(m_caller->m_ctx)))
 			{
-				std::cerr << "yield() to t_thread_fiber failed\n";
+				std::cerr << "yield() to caller fiber failed\n";
 				pthread_exit(NULL);
 			}
 		}
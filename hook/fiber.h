@@ -12,6 +12,7 @@
 
 namespace sylar
 {
+	class CancelToken;
 
 	class Fiber : public std::enable_shared_from_this<Fiber>
 	{
@@ -75,9 +76,19 @@ namespace sylar
 		std::function<void()> m_cb;
 		// 是否让出执行权交给调度协程
 		bool m_runInScheduler;
+		// m_runInScheduler为false时恢复它的协程，yield()返回到这里：线程的主协程，或者消费生成器的协程
+		Fiber *m_caller = nullptr;
 
 	public:
 		std::mutex m_mutex;
+		// 通过钩子持有的pthread互斥锁数量，见hook.cpp中的pthread_mutex_lock()
+		int m_hookedLocks = 0;
+		// 位于运行时自身的加锁中，见hook.h中的RuntimeScope
+		int m_runtimeDepth = 0;
+		// 钩子操作的截止时间(steady_clock毫秒)，-1 -> 没有，见hook.h中的DeadlineScope
+		uint64_t m_deadline = (uint64_t)-1;
+		// 取消令牌，见fiber_sync.h中的CancelToken
+		std::shared_ptr<CancelToken> m_cancelToken;
 	};
 
 }
@@ -0,0 +1,427 @@
+#include "fiber_sync.h"
+
+namespace sylar
+{
+
+    bool FiberWaiter::CanPark()
+    {
+        // 钩子只在调度器的工作线程上启用 -> 此时运行在调度的协程中
+        return Scheduler::GetThis() != nullptr && is_hook_enable();
+    }
+
+    FiberWaiter::FiberWaiter()
+    {
+        if (CanPark())
+        {
+            fiber = Fiber::GetThis();
+            self = fiber.get();
+            scheduler = Scheduler::GetThis();
+        }
+    }
+
+    void FiberWaiter::wait(std::unique_lock<std::mutex> &lock)
+    {
+        lock.unlock();
+        wait();
+    }
+
+    void FiberWaiter::wait()
+    {
+        // wake()可能已经执行 -> 只能使用self
+        if (self)
+        {
+            self->yield();
+        }
+        else
+        {
+            sem.wait();
+        }
+    }
+
+    void FiberWaiter::wake()
+    {
+        // 唤醒之后等待者随时可能析构 -> 不再访问成员
+        if (fiber)
+        {
+            std::shared_ptr<Fiber> f;
+            f.swap(fiber);
+            scheduler->scheduleLock(f);
+        }
+        else
+        {
+            sem.signal();
+        }
+    }
+
+    void CancelToken::cancel()
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancelled)
+        {
+            return;
+        }
+        m_cancelled = true;
+        for (auto &it : m_waiters)
+        {
+            it.second();
+        }
+        m_waiters.clear();
+    }
+
+    uint64_t CancelToken::addWaiter(std::function<void()> cb)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancelled)
+        {
+            return 0;
+        }
+        uint64_t id = m_nextId++;
+        m_waiters.emplace(id, std::move(cb));
+        return id;
+    }
+
+    void CancelToken::removeWaiter(uint64_t id)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_waiters.erase(id);
+    }
+
+    CancelToken::ptr CancelToken::GetThis()
+    {
+        Fiber *task = Scheduler::GetRunningTask();
+        return task ? task->m_cancelToken : nullptr;
+    }
+
+    void CancelToken::SetThis(ptr token)
+    {
+        Fiber *task = Scheduler::GetRunningTask();
+        if (task)
+        {
+            task->m_cancelToken = std::move(token);
+        }
+    }
+
+    CancelWait::CancelWait(std::function<void()> cb) : m_token(CancelToken::GetThis())
+    {
+        if (!m_token)
+        {
+            return;
+        }
+        m_id = m_token->addWaiter(std::move(cb));
+        m_cancelled = m_id == 0;
+    }
+
+    CancelWait::~CancelWait()
+    {
+        if (m_id)
+        {
+            m_token->removeWaiter(m_id);
+        }
+    }
+
+    bool FiberMutex::try_lock()
+    {
+        bool expected = false;
+        return m_locked.compare_exchange_strong(expected, true, std::memory_order_acquire);
+    }
+
+    void FiberMutex::lock()
+    {
+        if (try_lock())
+        {
+            return;
+        }
+
+        if (adaptive_spin(m_spins, [this]()
+                          { return !m_locked.load(std::memory_order_relaxed) && try_lock(); }))
+        {
+            return;
+        }
+
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (try_lock())
+        {
+            return;
+        }
+
+        FiberWaiter waiter;
+        m_waiters.push_back(&waiter);
+        // 被唤醒时锁已经移交给当前协程
+        waiter.wait(lock);
+    }
+
+    void FiberMutex::unlock()
+    {
+        FiberWaiter *next = nullptr;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_waiters.empty())
+            {
+                m_locked.store(false, std::memory_order_release);
+                return;
+            }
+            next = m_waiters.front();
+            m_waiters.pop_front();
+        }
+        // m_locked保持为true -> 直接移交
+        next->wake();
+    }
+
+    void FiberConditionVariable::wait(std::unique_lock<FiberMutex> &lk)
+    {
+        FiberWaiter waiter;
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiters.push_back(&waiter);
+        // 入队之后再释放用户锁 -> 不会丢失通知
+        lk.unlock();
+        waiter.wait(lock);
+        lk.lock();
+    }
+
+    void FiberConditionVariable::notify_one()
+    {
+        FiberWaiter *next = nullptr;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_waiters.empty())
+            {
+                return;
+            }
+            next = m_waiters.front();
+            m_waiters.pop_front();
+        }
+        next->wake();
+    }
+
+    void FiberConditionVariable::notify_all()
+    {
+        std::deque<FiberWaiter *> waiters;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            waiters.swap(m_waiters);
+        }
+        for (FiberWaiter *waiter : waiters)
+        {
+            waiter->wake();
+        }
+    }
+
+    bool FiberSemaphore::try_wait()
+    {
+        int count = m_count.load(std::memory_order_relaxed);
+        while (count > 0)
+        {
+            if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void FiberSemaphore::wait()
+    {
+        if (try_wait())
+        {
+            return;
+        }
+
+        if (adaptive_spin(m_spins, [this]()
+                          { return try_wait(); }))
+        {
+            return;
+        }
+
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // 计数只在持有m_mutex时增加 -> 这里检查之后不会漏掉signal()
+        if (try_wait())
+        {
+            return;
+        }
+
+        FiberWaiter waiter;
+        m_waiters.push_back(&waiter);
+        waiter.wait(lock);
+    }
+
+    void FiberSemaphore::signal()
+    {
+        FiberWaiter *next = nullptr;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_waiters.empty())
+            {
+                m_count.fetch_add(1, std::memory_order_release);
+                return;
+            }
+            next = m_waiters.front();
+            m_waiters.pop_front();
+        }
+        // 计数直接移交给等待者
+        next->wake();
+    }
+
+    bool FiberRWLock::try_lock()
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_writer || m_readers)
+        {
+            return false;
+        }
+        m_writer = true;
+        return true;
+    }
+
+    void FiberRWLock::lock()
+    {
+        if (adaptive_spin(m_spins, [this]()
+                          { return try_lock(); }))
+        {
+            return;
+        }
+
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_writer && !m_readers)
+        {
+            m_writer = true;
+            return;
+        }
+
+        FiberWaiter waiter;
+        m_writeWaiters.push_back(&waiter);
+        waiter.wait(lock);
+    }
+
+    void FiberRWLock::unlock()
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_writer);
+        m_writer = false;
+        wakeNext();
+    }
+
+    bool FiberRWLock::try_lock_shared()
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_writer || !m_writeWaiters.empty())
+        {
+            return false;
+        }
+        ++m_readers;
+        return true;
+    }
+
+    void FiberRWLock::lock_shared()
+    {
+        if (adaptive_spin(m_spins, [this]()
+                          { return try_lock_shared(); }))
+        {
+            return;
+        }
+
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_writer && m_writeWaiters.empty())
+        {
+            ++m_readers;
+            return;
+        }
+
+        FiberWaiter waiter;
+        m_readWaiters.push_back(&waiter);
+        waiter.wait(lock);
+    }
+
+    void FiberRWLock::unlock_shared()
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_readers > 0);
+        if (--m_readers == 0)
+        {
+            wakeNext();
+        }
+    }
+
+    void FiberRWLock::wakeNext()
+    {
+        if (m_writer || m_readers)
+        {
+            return;
+        }
+
+        // 写者优先
+        if (!m_writeWaiters.empty())
+        {
+            FiberWaiter *next = m_writeWaiters.front();
+            m_writeWaiters.pop_front();
+            m_writer = true;
+            next->wake();
+            return;
+        }
+
+        // 唤醒所有读者
+        while (!m_readWaiters.empty())
+        {
+            FiberWaiter *next = m_readWaiters.front();
+            m_readWaiters.pop_front();
+            ++m_readers;
+            next->wake();
+        }
+    }
+
+    void WaitGroup::add(int n)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_count += n;
+        assert(m_count >= 0);
+    }
+
+    void WaitGroup::done()
+    {
+        std::deque<FiberWaiter *> waiters;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            assert(m_count > 0);
+            if (--m_count == 0)
+            {
+                waiters.swap(m_waiters);
+            }
+        }
+        // 解锁之后只访问已出队的等待者
+        for (FiberWaiter *w : waiters)
+        {
+            w->wake();
+        }
+    }
+
+    void WaitGroup::wait()
+    {
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_count == 0)
+        {
+            return;
+        }
+        FiberWaiter waiter;
+        m_waiters.push_back(&waiter);
+        waiter.wait(lock);
+    }
+
+}
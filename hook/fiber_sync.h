@@ -0,0 +1,234 @@
+#ifndef _FIBER_SYNC_H_
+#define _FIBER_SYNC_H_
+
+#include "scheduler.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace sylar
+{
+
+    // 等待者：在调度器的协程中 -> 挂起协程，唤醒时通过其调度器重新调度；否则 -> 阻塞线程
+    struct FiberWaiter
+    {
+        std::shared_ptr<Fiber> fiber;
+        // 挂起的协程，wake()会取走fiber -> 单独保存
+        Fiber *self = nullptr;
+        Scheduler *scheduler = nullptr;
+        Semaphore sem;
+
+        FiberWaiter();
+
+        // 已入队且持有lock -> 释放lock并挂起，直到wake()
+        void wait(std::unique_lock<std::mutex> &lock);
+        // 已入队且已释放所有锁 -> 挂起，直到wake()
+        void wait();
+        // 出队之后调用，每个等待者只能被唤醒一次
+        void wake();
+
+        // 当前执行流是否可以挂起协程
+        static bool CanPark();
+    };
+
+    // 自适应自旋：成功时返回true，并用本次的自旋次数更新平均值
+    template <typename TryFn>
+    bool adaptive_spin(std::atomic<int> &avg, TryFn try_fn)
+    {
+        static const int MAX_SPINS = 100;
+
+        int spins = avg.load(std::memory_order_relaxed);
+        int limit = std::min(MAX_SPINS, spins * 2 + 10);
+        for (int i = 0; i < limit; ++i)
+        {
+            if (try_fn())
+            {
+                avg.store(spins + (i - spins) / 8, std::memory_order_relaxed);
+                return true;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        avg.store(spins + (limit - spins) / 8, std::memory_order_relaxed);
+        return false;
+    }
+
+    // 取消令牌：挂到一个或一组任务协程上，cancel()之后这些协程中挂起的钩子调用(读写、accept、connect、poll/select、sleep)
+    // 以及通道的收发/select立即返回，errno为ECANCELED；之后新的等待也立即返回
+    // 互斥锁、条件变量、信号量的等待不能失败 -> 不受影响
+    class CancelToken
+    {
+    public:
+        typedef std::shared_ptr<CancelToken> ptr;
+
+        CancelToken() = default;
+        CancelToken(const CancelToken &) = delete;
+        CancelToken &operator=(const CancelToken &) = delete;
+
+        void cancel();
+        bool isCancelled() const { return m_cancelled; }
+
+        // 挂起之前登记唤醒函数，已经取消时返回0且不登记
+        // cancel()持有令牌的锁调用cb -> removeWaiter()返回之后cb不会再运行
+        uint64_t addWaiter(std::function<void()> cb);
+        void removeWaiter(uint64_t id);
+
+        // 当前任务协程的令牌，不在任务协程中或没有令牌 -> nullptr
+        static ptr GetThis();
+        // 设置当前任务协程的令牌，一组协程可以共享同一个令牌
+        static void SetThis(ptr token);
+
+    private:
+        std::atomic<bool> m_cancelled = {false};
+        std::mutex m_mutex;
+        uint64_t m_nextId = 1;
+        std::map<uint64_t, std::function<void()>> m_waiters;
+    };
+
+    // 一次挂起期间登记到当前协程的取消令牌上，析构时注销
+    class CancelWait
+    {
+    public:
+        explicit CancelWait(std::function<void()> cb);
+        ~CancelWait();
+
+        CancelWait(const CancelWait &) = delete;
+        CancelWait &operator=(const CancelWait &) = delete;
+
+        // 令牌已经取消 -> 不要挂起
+        bool cancelled() const { return m_cancelled; }
+
+    private:
+        CancelToken::ptr m_token;
+        uint64_t m_id = 0;
+        bool m_cancelled = false;
+    };
+
+    // 协程互斥锁：竞争时先自旋，再挂起当前协程，解锁时把锁直接交给队首的等待者
+    class FiberMutex
+    {
+    public:
+        FiberMutex() = default;
+        FiberMutex(const FiberMutex &) = delete;
+        FiberMutex &operator=(const FiberMutex &) = delete;
+
+        void lock();
+        bool try_lock();
+        void unlock();
+
+    private:
+        std::atomic<bool> m_locked = {false};
+        std::atomic<int> m_spins = {0};
+        // 保护等待队列
+        std::mutex m_mutex;
+        std::deque<FiberWaiter *> m_waiters;
+    };
+
+    // 协程条件变量，配合FiberMutex使用
+    class FiberConditionVariable
+    {
+    public:
+        FiberConditionVariable() = default;
+        FiberConditionVariable(const FiberConditionVariable &) = delete;
+        FiberConditionVariable &operator=(const FiberConditionVariable &) = delete;
+
+        void wait(std::unique_lock<FiberMutex> &lock);
+
+        template <typename Predicate>
+        void wait(std::unique_lock<FiberMutex> &lock, Predicate pred)
+        {
+            while (!pred())
+            {
+                wait(lock);
+            }
+        }
+
+        void notify_one();
+        void notify_all();
+
+    private:
+        std::mutex m_mutex;
+        std::deque<FiberWaiter *> m_waiters;
+    };
+
+    // 协程信号量
+    class FiberSemaphore
+    {
+    public:
+        explicit FiberSemaphore(int count = 0) : m_count(count) {}
+        FiberSemaphore(const FiberSemaphore &) = delete;
+        FiberSemaphore &operator=(const FiberSemaphore &) = delete;
+
+        // P操作
+        void wait();
+        bool try_wait();
+        // V操作
+        void signal();
+
+    private:
+        std::atomic<int> m_count;
+        std::atomic<int> m_spins = {0};
+        std::mutex m_mutex;
+        std::deque<FiberWaiter *> m_waiters;
+    };
+
+    // 协程读写锁，写优先：有写者等待时新的读者也要排队
+    class FiberRWLock
+    {
+    public:
+        FiberRWLock() = default;
+        FiberRWLock(const FiberRWLock &) = delete;
+        FiberRWLock &operator=(const FiberRWLock &) = delete;
+
+        // 写锁
+        void lock();
+        bool try_lock();
+        void unlock();
+
+        // 读锁
+        void lock_shared();
+        bool try_lock_shared();
+        void unlock_shared();
+
+    private:
+        // no lock
+        void wakeNext();
+
+    private:
+        std::mutex m_mutex;
+        // 持有读锁的数量
+        int m_readers = 0;
+        // 是否有写者持有锁
+        bool m_writer = false;
+        std::atomic<int> m_spins = {0};
+        std::deque<FiberWaiter *> m_readWaiters;
+        std::deque<FiberWaiter *> m_writeWaiters;
+    };
+
+    // 等待一组任务结束：add()登记任务数，每个任务结束时done()，wait()挂起直到计数归零
+    // 计数在锁内修改 -> wait()返回之后done()不再访问本对象，等待者可以立即析构它
+    class WaitGroup
+    {
+    public:
+        WaitGroup() = default;
+        WaitGroup(const WaitGroup &) = delete;
+        WaitGroup &operator=(const WaitGroup &) = delete;
+
+        void add(int n = 1);
+        void done();
+        void wait();
+
+    private:
+        std::mutex m_mutex;
+        int m_count = 0;
+        std::deque<FiberWaiter *> m_waiters;
+    };
+
+}
+
+#endif
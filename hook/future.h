@@ -0,0 +1,437 @@
+#ifndef _FUTURE_H_
+#define _FUTURE_H_
+
+#include "fiber_sync.h"
+
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+
+namespace sylar
+{
+
+    template <typename T>
+    class Future;
+
+    namespace detail
+    {
+
+        // void没有值 -> 用bool占位
+        template <typename T>
+        using FutureValue = std::conditional_t<std::is_void<T>::value, bool, T>;
+
+        // then(f)的结果类型：Future<void> -> f()；否则 -> f(T)
+        template <typename T, typename F, bool = std::is_void<T>::value>
+        struct ThenResult
+        {
+            using type = std::invoke_result_t<F &, T>;
+        };
+
+        template <typename T, typename F>
+        struct ThenResult<T, F, true>
+        {
+            using type = std::invoke_result_t<F &>;
+        };
+
+        // Promise和Future之间的共享状态，结果只能设置一次
+        template <typename T>
+        struct FutureState
+        {
+            std::atomic<bool> ready = {false};
+            std::mutex mutex;
+            std::optional<FutureValue<T>> value;
+            std::exception_ptr error;
+            std::deque<FiberWaiter *> waiters;
+            // 由设置结果的执行流在唤醒等待者之后运行
+            std::function<void()> continuation;
+
+            template <typename... Args>
+            void setValue(Args &&...args)
+            {
+                std::function<void()> cb;
+                {
+                    RuntimeScope scope;
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (ready)
+                    {
+                        throw std::future_error(std::future_errc::promise_already_satisfied);
+                    }
+                    value.emplace(std::forward<Args>(args)...);
+                    cb = finish(lock);
+                }
+                if (cb)
+                {
+                    cb();
+                }
+            }
+
+            void setException(std::exception_ptr e)
+            {
+                std::function<void()> cb;
+                {
+                    RuntimeScope scope;
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (ready)
+                    {
+                        throw std::future_error(std::future_errc::promise_already_satisfied);
+                    }
+                    error = e;
+                    cb = finish(lock);
+                }
+                if (cb)
+                {
+                    cb();
+                }
+            }
+
+            // 已经就绪 -> 直接返回；否则 -> 挂起当前协程(或阻塞线程)直到结果被设置
+            void wait()
+            {
+                if (ready.load(std::memory_order_acquire))
+                {
+                    return;
+                }
+                RuntimeScope scope;
+                std::unique_lock<std::mutex> lock(mutex);
+                if (ready)
+                {
+                    return;
+                }
+                FiberWaiter waiter;
+                waiters.push_back(&waiter);
+                waiter.wait(lock);
+            }
+
+        private:
+            // 唤醒等待者，返回延续 -> 调用者在运行时的作用域之外运行它
+            std::function<void()> finish(std::unique_lock<std::mutex> &lock)
+            {
+                ready.store(true, std::memory_order_release);
+                std::deque<FiberWaiter *> wake;
+                wake.swap(waiters);
+                std::function<void()> cb;
+                cb.swap(continuation);
+                lock.unlock();
+
+                // 挂起的协程通过其调度器重新调度
+                for (FiberWaiter *w : wake)
+                {
+                    w->wake();
+                }
+                return cb;
+            }
+        };
+
+        struct FutureAccess;
+
+    }
+
+    // 协程友好的future：get()在协程中挂起协程而不是阻塞工作线程
+    // 已经就绪的结果直接保存在Future中 -> make_ready_future()以及就绪之后的then()都不分配共享状态
+    // 结果只能取一次：get()和then()之后Future失效
+    template <typename T>
+    class Future
+    {
+    public:
+        Future() = default;
+        Future(Future &&other) noexcept { moveFrom(other); }
+        Future &operator=(Future &&other) noexcept
+        {
+            if (this != &other)
+            {
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        Future(const Future &) = delete;
+        Future &operator=(const Future &) = delete;
+
+        bool valid() const { return m_ready || m_state; }
+        bool isReady() const { return m_ready || (m_state && m_state->ready.load(std::memory_order_acquire)); }
+
+        void wait() const
+        {
+            assert(valid());
+            if (!m_ready)
+            {
+                m_state->wait();
+            }
+        }
+
+        // 等待并取出结果，Promise设置的异常在这里重新抛出
+        T get();
+
+        // 结果就绪之后以结果调用f，返回f的结果的Future；异常跳过f直接传递
+        // 已经就绪 -> 在当前执行流中立即调用；否则 -> 在设置结果的执行流中调用
+        template <typename F>
+        Future<typename detail::ThenResult<T, F>::type> then(F f);
+
+    private:
+        friend struct detail::FutureAccess;
+
+        void moveFrom(Future &other)
+        {
+            m_ready = other.m_ready;
+            m_value = std::move(other.m_value);
+            m_error = std::move(other.m_error);
+            m_state = std::move(other.m_state);
+            other.reset();
+        }
+
+        void reset()
+        {
+            m_ready = false;
+            m_value.reset();
+            m_error = nullptr;
+            m_state.reset();
+        }
+
+    private:
+        // true -> 结果保存在m_value或m_error中，没有共享状态
+        bool m_ready = false;
+        std::optional<detail::FutureValue<T>> m_value;
+        std::exception_ptr m_error;
+        std::shared_ptr<detail::FutureState<T>> m_state;
+    };
+
+    namespace detail
+    {
+
+        struct FutureAccess
+        {
+            template <typename T, typename... Args>
+            static Future<T> ready(Args &&...args)
+            {
+                Future<T> f;
+                f.m_ready = true;
+                f.m_value.emplace(std::forward<Args>(args)...);
+                return f;
+            }
+
+            template <typename T>
+            static Future<T> failed(std::exception_ptr error)
+            {
+                Future<T> f;
+                f.m_ready = true;
+                f.m_error = error;
+                return f;
+            }
+
+            template <typename T>
+            static Future<T> pending(std::shared_ptr<FutureState<T>> state)
+            {
+                Future<T> f;
+                f.m_state = std::move(state);
+                return f;
+            }
+
+            template <typename T, typename F>
+            static decltype(auto) call(F &f, std::optional<FutureValue<T>> &value)
+            {
+                if constexpr (std::is_void<T>::value)
+                {
+                    return f();
+                }
+                else
+                {
+                    return f(std::move(*value));
+                }
+            }
+
+            // 结果已经就绪 -> 结果直接保存在返回的Future中
+            template <typename R, typename T, typename F>
+            static Future<R> invoke(F &f, std::optional<FutureValue<T>> &value, std::exception_ptr error)
+            {
+                if (error)
+                {
+                    return failed<R>(error);
+                }
+                try
+                {
+                    if constexpr (std::is_void<R>::value)
+                    {
+                        call<T>(f, value);
+                        return ready<R>(true);
+                    }
+                    else
+                    {
+                        return ready<R>(call<T>(f, value));
+                    }
+                }
+                catch (...)
+                {
+                    return failed<R>(std::current_exception());
+                }
+            }
+
+            // 延续：结果写入then()返回的共享状态
+            template <typename R, typename T, typename F>
+            static void invoke(F &f, std::optional<FutureValue<T>> &value, std::exception_ptr error, FutureState<R> &out)
+            {
+                if (error)
+                {
+                    out.setException(error);
+                    return;
+                }
+                std::optional<FutureValue<R>> result;
+                try
+                {
+                    if constexpr (std::is_void<R>::value)
+                    {
+                        call<T>(f, value);
+                        result.emplace(true);
+                    }
+                    else
+                    {
+                        result.emplace(call<T>(f, value));
+                    }
+                }
+                catch (...)
+                {
+                    out.setException(std::current_exception());
+                    return;
+                }
+                out.setValue(std::move(*result));
+            }
+        };
+
+    }
+
+    template <typename T>
+    T Future<T>::get()
+    {
+        wait();
+        Future tmp(std::move(*this));
+        std::optional<detail::FutureValue<T>> &value = tmp.m_ready ? tmp.m_value : tmp.m_state->value;
+        std::exception_ptr error = tmp.m_ready ? tmp.m_error : tmp.m_state->error;
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        if constexpr (!std::is_void<T>::value)
+        {
+            return std::move(*value);
+        }
+    }
+
+    template <typename T>
+    template <typename F>
+    Future<typename detail::ThenResult<T, F>::type> Future<T>::then(F f)
+    {
+        using R = typename detail::ThenResult<T, F>::type;
+        assert(valid());
+
+        if (m_ready)
+        {
+            Future tmp(std::move(*this));
+            return detail::FutureAccess::invoke<R, T>(f, tmp.m_value, tmp.m_error);
+        }
+
+        std::shared_ptr<detail::FutureState<T>> state = std::move(m_state);
+        reset();
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->ready)
+            {
+                assert(!state->continuation);
+                std::shared_ptr<detail::FutureState<R>> out = std::make_shared<detail::FutureState<R>>();
+                // 延续持有两端的共享状态 -> 不依赖Future和Promise的生命周期
+                state->continuation = [state, out, f]() mutable
+                {
+                    detail::FutureAccess::invoke<R, T>(f, state->value, state->error, *out);
+                };
+                return detail::FutureAccess::pending<R>(out);
+            }
+        }
+        return detail::FutureAccess::invoke<R, T>(f, state->value, state->error);
+    }
+
+    // 写端：setValue()/setException()唤醒挂起在get()上的协程
+    // 析构时仍未设置结果 -> 以broken_promise异常结束
+    template <typename T>
+    class Promise
+    {
+    public:
+        Promise() : m_state(std::make_shared<detail::FutureState<T>>()) {}
+        ~Promise() { abandon(); }
+
+        Promise(Promise &&other) noexcept : m_state(std::move(other.m_state)), m_retrieved(other.m_retrieved) {}
+        Promise &operator=(Promise &&other) noexcept
+        {
+            if (this != &other)
+            {
+                abandon();
+                m_state = std::move(other.m_state);
+                m_retrieved = other.m_retrieved;
+            }
+            return *this;
+        }
+
+        Promise(const Promise &) = delete;
+        Promise &operator=(const Promise &) = delete;
+
+        // 只能调用一次
+        Future<T> getFuture()
+        {
+            assert(m_state);
+            if (m_retrieved)
+            {
+                throw std::future_error(std::future_errc::future_already_retrieved);
+            }
+            m_retrieved = true;
+            return detail::FutureAccess::pending<T>(m_state);
+        }
+
+        // Promise<void> -> setValue()
+        template <typename... Args>
+        void setValue(Args &&...args)
+        {
+            assert(m_state);
+            m_state->setValue(std::forward<Args>(args)...);
+        }
+
+        void setException(std::exception_ptr error)
+        {
+            assert(m_state);
+            m_state->setException(error);
+        }
+
+    private:
+        void abandon()
+        {
+            if (m_state && !m_state->ready)
+            {
+                m_state->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+            m_state.reset();
+        }
+
+    private:
+        std::shared_ptr<detail::FutureState<T>> m_state;
+        bool m_retrieved = false;
+    };
+
+    // 已经就绪的Future，不分配共享状态
+    template <typename T, typename... Args>
+    Future<T> make_ready_future(Args &&...args)
+    {
+        return detail::FutureAccess::ready<T>(std::forward<Args>(args)...);
+    }
+
+    inline Future<void> make_ready_future()
+    {
+        return detail::FutureAccess::ready<void>(true);
+    }
+
+    template <typename T>
+    Future<T> make_exceptional_future(std::exception_ptr error)
+    {
+        return detail::FutureAccess::failed<T>(error);
+    }
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef _GENERATOR_H_
+#define _GENERATOR_H_
+
+#include "fiber.h"
+#include "hook.h"
+
+#include <exception>
+#include <iterator>
+
+namespace sylar
+{
+
+    // 生成器：生产者在独立的Fiber中运行，每次yield把一个值交给消费者
+    // 生成器协程不经过调度器(run_in_scheduler = false)：resume()/yield()直接在消费者与生产者之间切换，消费者可以是任意协程或普通线程
+    // 值留在生产者的栈上，消费者通过引用读取 -> 每个元素不分配内存、不拷贝
+    // work flow
+    // 1 begin()/next() 恢复生产者 -> 2 生产者yield(v)记下v的地址并切回消费者 -> 3 消费者读取v -> 4 再次next() -> ... -> 生产者返回
+    // 生产者中钩子被关闭 -> 阻塞调用阻塞线程，而不是挂起生成器协程
+    // 消费者提前析构生成器 -> 挂起中的yield抛出GeneratorExit，展开生产者的栈
+    // 生产者吞掉GeneratorExit之后再次yield -> 没有消费者可以接收，std::terminate()
+    struct GeneratorExit
+    {
+    };
+
+    template <typename T>
+    class Generator
+    {
+    public:
+        class Yield;
+
+    private:
+        struct State
+        {
+            std::function<void(Yield &)> body;
+            std::shared_ptr<Fiber> fiber;
+            // 当前值，位于生产者的栈上
+            T *current = nullptr;
+            std::exception_ptr error;
+            bool started = false;
+            // 析构中 -> yield抛出GeneratorExit
+            bool closing = false;
+
+            ~State()
+            {
+                if (!started || fiber->getState() == Fiber::TERM)
+                {
+                    return;
+                }
+                closing = true;
+                // 再次yield会terminate -> 恢复一次之后生产者一定已经结束
+                resume();
+                assert(fiber->getState() == Fiber::TERM);
+            }
+
+            void resume()
+            {
+                started = true;
+                current = nullptr;
+                bool hook = is_hook_enable();
+                set_hook_enable(false);
+                fiber->resume();
+                set_hook_enable(hook);
+            }
+
+            void advance()
+            {
+                assert(fiber->getState() != Fiber::TERM);
+                resume();
+                if (error)
+                {
+                    std::exception_ptr e = error;
+                    error = nullptr;
+                    std::rethrow_exception(e);
+                }
+            }
+
+            bool done() const { return fiber->getState() == Fiber::TERM; }
+        };
+
+    public:
+        // 生产者通过它交出值
+        class Yield
+        {
+        public:
+            // 消费者读取期间v一直有效(临时对象在本次调用返回之前有效)
+            void operator()(T &v) const { suspend(&v); }
+            void operator()(T &&v) const { suspend(&v); }
+            // 常量 -> 在生产者的栈上拷贝一份
+            void operator()(const T &v) const
+            {
+                T copy(v);
+                suspend(&copy);
+            }
+
+        private:
+            friend class Generator;
+            explicit Yield(State *state) : m_state(state) {}
+
+            void suspend(T *v) const
+            {
+                if (m_state->closing)
+                {
+                    std::terminate();
+                }
+                m_state->current = v;
+                m_state->fiber->yield();
+                if (m_state->closing)
+                {
+                    throw GeneratorExit();
+                }
+            }
+
+        private:
+            State *m_state;
+        };
+
+        class iterator
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T *;
+            using reference = T &;
+
+            iterator() = default;
+
+            reference operator*() const { return *m_state->current; }
+            pointer operator->() const { return m_state->current; }
+
+            iterator &operator++()
+            {
+                m_state->advance();
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+
+            // 生产者结束 -> 等于end()
+            bool operator==(const iterator &other) const { return done() == other.done(); }
+            bool operator!=(const iterator &other) const { return !(*this == other); }
+
+        private:
+            friend class Generator;
+            explicit iterator(State *state) : m_state(state) {}
+
+            bool done() const { return !m_state || m_state->done(); }
+
+        private:
+            State *m_state = nullptr;
+        };
+
+        // body在第一次begin()/next()时才开始运行
+        explicit Generator(std::function<void(Yield &)> body, size_t stacksize = 0) : m_state(std::make_unique<State>())
+        {
+            State *state = m_state.get();
+            state->body = std::move(body);
+            state->fiber = std::make_shared<Fiber>([state]()
+                                                   {
+                Yield yield(state);
+                try
+                {
+                    state->body(yield);
+                }
+                catch (const GeneratorExit &)
+                {
+                }
+                catch (...)
+                {
+                    if (!state->closing)
+                    {
+                        state->error = std::current_exception();
+                    }
+                }
+                state->current = nullptr; },
+                                                   stacksize, false);
+        }
+
+        Generator(Generator &&) noexcept = default;
+        Generator &operator=(Generator &&) noexcept = default;
+
+        Generator(const Generator &) = delete;
+        Generator &operator=(const Generator &) = delete;
+
+        // 取下一个值，生产者结束返回false；生产者抛出的异常在这里重新抛出
+        bool next()
+        {
+            if (m_state->done())
+            {
+                return false;
+            }
+            m_state->advance();
+            return !m_state->done();
+        }
+
+        // next()返回true之后有效
+        T &value() const { return *m_state->current; }
+
+        // 只能遍历一次
+        iterator begin()
+        {
+            if (!m_state->started)
+            {
+                m_state->advance();
+            }
+            return iterator(m_state.get());
+        }
+        iterator end() { return iterator(); }
+
+    private:
+        std::unique_ptr<State> m_state;
+    };
+
+}
+
+#endif
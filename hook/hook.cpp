@@ -1,9 +1,19 @@
 #include "hook.h"
+#include "blocking_pool.h"
 #include "fd_manager.h"
 #include "ioscheduler.h"
+#include "resolver.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
 #include <cstdarg>
+#include <deque>
 #include <dlfcn.h>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 #include <string.h>
 
 // apply XX to all functions
@@ -14,6 +24,7 @@
     XX(socket)       \
     XX(connect)      \
     XX(accept)       \
+    XX(accept4)      \
     XX(read)         \
     XX(readv)        \
     XX(recv)         \
@@ -28,7 +39,37 @@
     XX(fcntl)        \
     XX(ioctl)        \
     XX(getsockopt)   \
-    XX(setsockopt)
+    XX(setsockopt)   \
+    XX(getaddrinfo)  \
+    XX(pread)        \
+    XX(pwrite)       \
+    XX(preadv)       \
+    XX(pwritev)      \
+    XX(fsync)        \
+    XX(fdatasync)    \
+    XX(poll)         \
+    XX(ppoll)        \
+    XX(select)                 \
+    XX(epoll_wait)             \
+    XX(pthread_mutex_lock)     \
+    XX(pthread_mutex_trylock)  \
+    XX(pthread_mutex_unlock)   \
+    XX(pthread_cond_wait)      \
+    XX(pthread_cond_timedwait) \
+    XX(pthread_cond_clockwait) \
+    XX(pthread_cond_signal)    \
+    XX(pthread_cond_broadcast) \
+    XX(dup)                    \
+    XX(dup2)                   \
+    XX(dup3)
+
+// wake every fiber parked on a pthread wait, see sylar::set_pthread_hook_enable()
+static void unpark_all();
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 namespace sylar
 {
@@ -46,21 +87,89 @@ namespace sylar
         t_hook_enable = flag;
     }
 
-    void hook_init()
+    // process wide, see pthread_mutex_lock()
+    static std::atomic<bool> s_pthread_hook_enable = {false};
+
+    bool is_pthread_hook_enable()
     {
-        static bool is_inited = false;
-        if (is_inited)
+        return s_pthread_hook_enable;
+    }
+
+    void set_pthread_hook_enable(bool flag)
+    {
+        s_pthread_hook_enable = flag;
+        // disabled -> the unlock and signal hooks no longer wake parked fibers, they retry the blocking way
+        if (!flag)
+        {
+            unpark_all();
+        }
+    }
+
+    DeadlineScope::DeadlineScope(uint64_t ms, bool absolute)
+    {
+        m_fiber = Scheduler::GetRunningTask();
+        if (!m_fiber)
         {
             return;
         }
+        m_prev = m_fiber->m_deadline;
+        uint64_t deadline = absolute || ms == (uint64_t)-1 ? ms : now_ms() + ms;
+        m_fiber->m_deadline = std::min(m_prev, deadline);
+    }
+
+    DeadlineScope::~DeadlineScope()
+    {
+        if (m_fiber)
+        {
+            m_fiber->m_deadline = m_prev;
+        }
+    }
 
-        // test
-        is_inited = true;
+    uint64_t get_deadline()
+    {
+        Fiber *task = Scheduler::GetRunningTask();
+        return task ? task->m_deadline : (uint64_t)-1;
+    }
 
+    uint64_t deadline_remaining()
+    {
+        uint64_t deadline = get_deadline();
+        if (deadline == (uint64_t)-1)
+        {
+            return deadline;
+        }
+        uint64_t now = now_ms();
+        return deadline > now ? deadline - now : 0;
+    }
+
+    RuntimeScope::RuntimeScope()
+    {
+        m_fiber = Scheduler::GetRunningTask();
+        if (m_fiber)
+        {
+            ++m_fiber->m_runtimeDepth;
+        }
+    }
+
+    RuntimeScope::~RuntimeScope()
+    {
+        if (m_fiber)
+        {
+            --m_fiber->m_runtimeDepth;
+        }
+    }
+
+    void hook_init()
+    {
+        // other libraries may lock from several threads before the static initialisation of this file
+        static std::once_flag s_once;
+        std::call_once(s_once, []()
+                       {
 // assignment -> sleep_f = (sleep_fun)dlsym(RTLD_NEXT, "sleep"); -> dlsym -> fetch the original symbols/function
 #define XX(name) name##_f = (name##_fun)dlsym(RTLD_NEXT, #name);
         HOOK_FUN(XX)
 #undef XX
+                       });
     }
 
     // static variable initialisation will run before the main function
@@ -78,9 +187,509 @@ namespace sylar
 
 struct timer_info
 {
-    int cancelled = 0;
+    // ETIMEDOUT by the timer or ECANCELED by the cancellation token of the fiber, the first one wins
+    std::atomic<int> cancelled = {0};
 };
 
+// give up the event a fiber is parked on with error -> cancelEvent() resumes the fiber
+static void cancel_io(const std::weak_ptr<timer_info> &winfo, int fd, sylar::IOManager *iom, uint32_t event, int error)
+{
+    auto t = winfo.lock();
+    int expected = 0;
+    if (!t || !t->cancelled.compare_exchange_strong(expected, error))
+    {
+        return;
+    }
+    iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+}
+
+// the cancellation token of the running fiber has been cancelled
+static bool fiber_cancelled()
+{
+    sylar::CancelToken::ptr token = sylar::CancelToken::GetThis();
+    return token && token->isCancelled();
+}
+
+// the earlier of a per-call timeout and the deadline of the running fiber, -1 -> none
+static uint64_t deadline_clamp(uint64_t timeout_ms)
+{
+    return std::min(timeout_ms, sylar::deadline_remaining());
+}
+
+// regular files and block devices are always "ready" for epoll, so their calls block the thread
+// fds opened outside the hooks are registered the first time they are seen -> one fstat per fd, not per call
+// the ctx is trusted until close()/dup2() replace it through the hooks: a close() past them (e.g. inside fclose())
+// leaves a file ctx behind, and a pipe that reuses the number runs its calls on the blocking pool, correct but slower
+static bool is_file(int fd, std::shared_ptr<sylar::FdCtx> &ctx)
+{
+    if (!ctx)
+    {
+        ctx = sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    return ctx && ctx->isFile();
+}
+
+// file io -> run it on the blocking pool and park the calling fiber
+template <typename OriginFun, typename... Args>
+static auto do_file_io(int fd, OriginFun fun, Args... args) -> decltype(fun(fd, args...))
+{
+    if (!sylar::t_hook_enable)
+    {
+        return fun(fd, args...);
+    }
+    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if (!is_file(fd, ctx))
+    {
+        return fun(fd, args...);
+    }
+    return sylar::await_blocking([&]()
+                                 { return fun(fd, args...); });
+}
+
+// shared by the callbacks (events, timer, unlock/signal) that may wake one parked fiber -> only the first of them does
+struct wait_info
+{
+    std::atomic<bool> woken = {false};
+    bool timedout = false;
+    sylar::FiberWaiter *waiter = nullptr;
+};
+
+// an fd event can have only one waiter in the IOManager -> sets that can't be registered are polled at this interval
+static const uint64_t s_poll_retry_ms = 10;
+
+// poll inside a fiber: register the interest set with the IOManager, park until one fd fires or
+// timeout_ms passes (-1 -> forever), then let poll() fill in revents
+static int do_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+{
+    int rt = poll_f(fds, nfds, 0);
+    if (rt != 0 || timeout_ms == 0)
+    {
+        return rt;
+    }
+
+    // one registration per fd even if several pollfds name it
+    std::map<int, uint32_t> interest;
+    for (nfds_t i = 0; i < nfds; ++i)
+    {
+        if (fds[i].fd < 0)
+        {
+            continue;
+        }
+        uint32_t event = 0;
+        if (fds[i].events & (POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND | POLLRDHUP))
+        {
+            event |= sylar::IOManager::READ;
+        }
+        if (fds[i].events & (POLLOUT | POLLWRNORM | POLLWRBAND))
+        {
+            event |= sylar::IOManager::WRITE;
+        }
+        if (event)
+        {
+            interest[fds[i].fd] |= event;
+        }
+    }
+
+    sylar::IOManager *iom = sylar::IOManager::GetThis();
+    uint64_t deadline = std::min(timeout_ms < 0 ? (uint64_t)-1 : now_ms() + timeout_ms, sylar::get_deadline());
+    while (true)
+    {
+        std::shared_ptr<wait_info> info(new wait_info);
+        sylar::FiberWaiter waiter;
+        info->waiter = &waiter;
+        auto wake = [info]()
+        {
+            if (!info->woken.exchange(true))
+            {
+                info->waiter->wake();
+            }
+        };
+        sylar::CancelWait cancel_wait(wake);
+        if (cancel_wait.cancelled())
+        {
+            errno = ECANCELED;
+            return -1;
+        }
+
+        // 1 register every fd event, or none of them
+        std::vector<std::pair<int, sylar::IOManager::Event>> added;
+        bool registered = true;
+        for (auto &it : interest)
+        {
+            for (sylar::IOManager::Event event : {sylar::IOManager::READ, sylar::IOManager::WRITE})
+            {
+                if (!(it.second & event))
+                {
+                    continue;
+                }
+                if (iom->addEvent(it.first, event, wake, info.get()))
+                {
+                    registered = false;
+                    break;
+                }
+                added.emplace_back(it.first, event);
+            }
+            if (!registered)
+            {
+                break;
+            }
+        }
+        if (!registered)
+        {
+            for (auto &it : added)
+            {
+                iom->delEvent(it.first, it.second, info.get());
+            }
+            added.clear();
+        }
+
+        // 2 timer for the timeout, or for the next retry
+        uint64_t wait_ms = (uint64_t)-1;
+        if (deadline != (uint64_t)-1)
+        {
+            uint64_t now = now_ms();
+            wait_ms = deadline > now ? deadline - now : 0;
+        }
+        if (!registered)
+        {
+            wait_ms = std::min(wait_ms, s_poll_retry_ms);
+        }
+        std::shared_ptr<sylar::Timer> timer;
+        if (wait_ms != (uint64_t)-1)
+        {
+            timer = iom->addTimer(wait_ms, wake);
+        }
+
+        // 3 resume either by an event or by the timer
+        waiter.wait();
+
+        if (timer)
+        {
+            timer->cancel();
+        }
+        // events that fired are gone, and another fiber may have registered the same fd event since -> leave that one alone
+        for (auto &it : added)
+        {
+            iom->delEvent(it.first, it.second, info.get());
+        }
+        if (fiber_cancelled())
+        {
+            errno = ECANCELED;
+            return -1;
+        }
+
+        rt = poll_f(fds, nfds, 0);
+        if (rt != 0 || (deadline != (uint64_t)-1 && now_ms() >= deadline))
+        {
+            return rt;
+        }
+        // an edge poll() doesn't report (e.g. plain data while only POLLPRI is wanted) or a retry -> wait again
+    }
+}
+
+// fibers parked on pthread mutexes and condition variables, keyed by their address
+// the table lock is taken through the original functions -> never parks
+static pthread_mutex_t s_park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<const void *, std::deque<std::shared_ptr<wait_info>>> s_parked;
+static std::atomic<size_t> s_parked_count = {0};
+// mutexes a thread's pthread_cond_wait() holds: glibc unlocks them internally, past the unlock hook
+static std::unordered_map<const void *, int> s_cond_released;
+static std::atomic<size_t> s_cond_released_count = {0};
+
+// the task fiber whose pthread calls the hooks handle, nullptr inside the runtime's own locking (see RuntimeScope)
+static sylar::Fiber *pthread_task()
+{
+    sylar::Fiber *task = sylar::Scheduler::GetRunningTask();
+    return task && task->m_runtimeDepth == 0 ? task : nullptr;
+}
+
+// the task fiber that may park on a pthread wait, holding held_locks hooked mutexes (a cond wait holds its own)
+// a fiber holding another hooked mutex blocks the thread as before -> the code that has to resume it may need that mutex
+static sylar::Fiber *pthread_parkable(int held_locks)
+{
+    if (!sylar::s_pthread_hook_enable || !sylar::t_hook_enable || !sylar::IOManager::GetThis())
+    {
+        return nullptr;
+    }
+    sylar::Fiber *task = pthread_task();
+    return task && task->m_hookedLocks == held_locks ? task : nullptr;
+}
+
+static void park(const void *addr, const std::shared_ptr<wait_info> &info)
+{
+    pthread_mutex_lock_f(&s_park_mutex);
+    s_parked[addr].push_back(info);
+    ++s_parked_count;
+    pthread_mutex_unlock_f(&s_park_mutex);
+}
+
+// after a timeout or a retry -> leave the queue if nobody took us out yet
+static void unpark(const void *addr, const std::shared_ptr<wait_info> &info)
+{
+    pthread_mutex_lock_f(&s_park_mutex);
+    auto it = s_parked.find(addr);
+    if (it != s_parked.end())
+    {
+        auto pos = std::find(it->second.begin(), it->second.end(), info);
+        if (pos != it->second.end())
+        {
+            it->second.erase(pos);
+            --s_parked_count;
+        }
+        if (it->second.empty())
+        {
+            s_parked.erase(it);
+        }
+    }
+    pthread_mutex_unlock_f(&s_park_mutex);
+}
+
+// wake one (or all) fibers parked on addr, skipping those already woken by their timer
+static void unpark_wake(const void *addr, bool all)
+{
+    std::vector<std::shared_ptr<wait_info>> woken;
+    pthread_mutex_lock_f(&s_park_mutex);
+    auto it = s_parked.find(addr);
+    if (it != s_parked.end())
+    {
+        auto &waiters = it->second;
+        while (!waiters.empty() && (all || woken.empty()))
+        {
+            std::shared_ptr<wait_info> info = waiters.front();
+            waiters.pop_front();
+            --s_parked_count;
+            if (!info->woken.exchange(true))
+            {
+                woken.push_back(info);
+            }
+        }
+        if (waiters.empty())
+        {
+            s_parked.erase(it);
+        }
+    }
+    pthread_mutex_unlock_f(&s_park_mutex);
+
+    for (auto &info : woken)
+    {
+        info->waiter->wake();
+    }
+}
+
+static void unpark_all()
+{
+    std::vector<std::shared_ptr<wait_info>> woken;
+    pthread_mutex_lock_f(&s_park_mutex);
+    for (auto &entry : s_parked)
+    {
+        for (auto &info : entry.second)
+        {
+            if (!info->woken.exchange(true))
+            {
+                woken.push_back(info);
+            }
+        }
+    }
+    s_parked.clear();
+    s_parked_count = 0;
+    pthread_mutex_unlock_f(&s_park_mutex);
+
+    for (auto &info : woken)
+    {
+        info->waiter->wake();
+    }
+}
+
+// park the current fiber on addr until unpark_wake() or timeout_ms (-1 -> forever), return false on timeout
+// queued runs once the fiber is in the queue, returning true -> no need to wait any more
+static bool park_wait(const void *addr, uint64_t timeout_ms, const std::function<bool()> &queued = nullptr)
+{
+    std::shared_ptr<wait_info> info(new wait_info);
+    sylar::FiberWaiter waiter;
+    info->waiter = &waiter;
+    park(addr, info);
+    if (queued && queued())
+    {
+        if (!info->woken.exchange(true))
+        {
+            unpark(addr, info);
+            return true;
+        }
+        // a wakeup is already on its way -> take it
+        waiter.wait();
+        return true;
+    }
+
+    std::shared_ptr<sylar::Timer> timer;
+    if (timeout_ms != (uint64_t)-1)
+    {
+        timer = sylar::IOManager::GetThis()->addTimer(timeout_ms, [info]()
+                                                      {
+            if (!info->woken.exchange(true))
+            {
+                info->timedout = true;
+                info->waiter->wake();
+            } });
+    }
+    waiter.wait();
+
+    if (timer)
+    {
+        timer->cancel();
+    }
+    if (info->timedout)
+    {
+        unpark(addr, info);
+    }
+    return !info->timedout;
+}
+
+// condition variable wait of a parkable fiber: queue up, release the mutex, park, lock it again
+static int do_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock, const struct timespec *abstime)
+{
+    uint64_t timeout_ms = (uint64_t)-1;
+    if (abstime)
+    {
+        struct timespec now;
+        clock_gettime(clock, &now);
+        int64_t left_ns = (abstime->tv_sec - now.tv_sec) * 1000000000LL + (abstime->tv_nsec - now.tv_nsec);
+        timeout_ms = left_ns > 0 ? (left_ns + 999999) / 1000000 : 0;
+    }
+
+    // queued before the unlock -> a signal sent right after it is not lost
+    bool signaled = park_wait(cond, timeout_ms, [mutex]()
+                              {
+        pthread_mutex_unlock(mutex);
+        return false; });
+    int rt = pthread_mutex_lock(mutex);
+    if (rt)
+    {
+        return rt;
+    }
+    return signaled ? 0 : ETIMEDOUT;
+}
+
+// a thread's cond wait holds mutex -> a fiber can't count on the unlock hook to wake it up
+static bool cond_released(const void *mutex)
+{
+    if (s_cond_released_count == 0)
+    {
+        return false;
+    }
+    pthread_mutex_lock_f(&s_park_mutex);
+    bool released = s_cond_released.count(mutex) > 0;
+    pthread_mutex_unlock_f(&s_park_mutex);
+    return released;
+}
+
+// condition variable wait of a thread (or a fiber that can't park): glibc unlocks the mutex internally
+// -> wake the fibers parked on it now, until the wait returns they lock it the blocking way (see pthread_mutex_lock())
+template <typename WaitFn>
+static int thread_cond_wait(pthread_mutex_t *mutex, WaitFn wait)
+{
+    if (!sylar::s_pthread_hook_enable)
+    {
+        return wait();
+    }
+
+    pthread_mutex_lock_f(&s_park_mutex);
+    ++s_cond_released[mutex];
+    ++s_cond_released_count;
+    pthread_mutex_unlock_f(&s_park_mutex);
+    if (s_parked_count > 0)
+    {
+        unpark_wake(mutex, true);
+    }
+
+    int rt = wait();
+
+    pthread_mutex_lock_f(&s_park_mutex);
+    auto it = s_cond_released.find(mutex);
+    if (--it->second == 0)
+    {
+        s_cond_released.erase(it);
+    }
+    --s_cond_released_count;
+    pthread_mutex_unlock_f(&s_park_mutex);
+    return rt;
+}
+
+// park the fiber for ms, return false if its cancellation token woke it up first
+static bool do_sleep(uint64_t ms)
+{
+    std::shared_ptr<wait_info> info(new wait_info);
+    sylar::FiberWaiter waiter;
+    info->waiter = &waiter;
+
+    sylar::CancelWait cancel_wait([info]()
+                                  {
+        if (!info->woken.exchange(true))
+        {
+            info->waiter->wake();
+        } });
+    if (cancel_wait.cancelled())
+    {
+        return false;
+    }
+
+    // the timer reschedules this fiber
+    std::shared_ptr<sylar::Timer> timer = sylar::IOManager::GetThis()->addTimer(ms, [info]()
+                                                                                 {
+        if (!info->woken.exchange(true))
+        {
+            info->timedout = true;
+            info->waiter->wake();
+        } });
+    // wait for the next resume
+    waiter.wait();
+    timer->cancel();
+    return info->timedout;
+}
+
+// sleep for timeout_ms within the fiber deadline, left_ms <- the time not slept
+// 0 -> slept all of it, EINTR -> cut short by the deadline, also one already past when called, ECANCELED -> by the cancellation token
+static int deadline_sleep(uint64_t timeout_ms, uint64_t &left_ms)
+{
+    uint64_t start = now_ms();
+    uint64_t sleep_ms = deadline_clamp(timeout_ms);
+    int rt = 0;
+    if (sleep_ms == 0 && timeout_ms > 0)
+    {
+        rt = fiber_cancelled() ? ECANCELED : EINTR;
+    }
+    else if (!do_sleep(sleep_ms))
+    {
+        rt = ECANCELED;
+    }
+    else if (sleep_ms < timeout_ms)
+    {
+        rt = EINTR;
+    }
+    left_ms = rt ? timeout_ms - std::min(now_ms() - start, timeout_ms) : 0;
+    return rt;
+}
+
+// newfd is about to be replaced by dup2()/dup3() -> tear it down like close() does
+static void dup_release(int oldfd, int newfd)
+{
+    // oldfd invalid -> dup2() fails and newfd stays open
+    if (oldfd == newfd || fcntl_f(oldfd, F_GETFD) == -1)
+    {
+        return;
+    }
+
+    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(newfd);
+    if (ctx)
+    {
+        auto iom = sylar::IOManager::GetThis();
+        if (iom)
+        {
+            iom->cancelAll(newfd);
+        }
+        sylar::FdMgr::GetInstance()->del(newfd);
+    }
+}
+
 // universal template for read and write function
 template <typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t event, int timeout_so, Args &&...args)
@@ -91,6 +700,17 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t
     }
 
     std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if (is_file(fd, ctx))
+    {
+        if (ctx->isClosed())
+        {
+            errno = EBADF;
+            return -1;
+        }
+        return sylar::await_blocking([&]()
+                                     { return fun(fd, std::forward<Args>(args)...); });
+    }
+
     if (!ctx)
     {
         return fun(fd, std::forward<Args>(args)...);
@@ -108,7 +728,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t
     }
 
     // get the timeout
-    uint64_t timeout = ctx->getTimeout(timeout_so);
+    uint64_t so_timeout = ctx->getTimeout(timeout_so);
     // timer condition
     std::shared_ptr<timer_info> tinfo(new timer_info);
 
@@ -125,6 +745,14 @@ retry:
     // 0 resource was temporarily unavailable -> retry until ready
     if (n == -1 && errno == EAGAIN)
     {
+        // the fd timeout applies to each wait, the fiber deadline to all of them
+        uint64_t timeout = deadline_clamp(so_timeout);
+        if (timeout == 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
         sylar::IOManager *iom = sylar::IOManager::GetThis();
         // timer
         std::shared_ptr<sylar::Timer> timer;
@@ -135,14 +763,8 @@ retry:
         {
             timer = iom->addConditionTimer(timeout, [winfo, fd, iom, event]()
                                            {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) 
-                {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
                 // cancel this event and trigger once to return to this fiber
-                iom->cancelEvent(fd, (sylar::IOManager::Event)(event)); }, winfo);
+                cancel_io(winfo, fd, iom, event, ETIMEDOUT); }, winfo);
         }
 
         // 2 add event -> callback is this fiber
@@ -158,15 +780,23 @@ retry:
         }
         else
         {
+            // 3 the cancellation token of the fiber cancels the event too, already cancelled -> at once
+            sylar::CancelWait cancel_wait([winfo, fd, iom, event]()
+                                          { cancel_io(winfo, fd, iom, event, ECANCELED); });
+            if (cancel_wait.cancelled())
+            {
+                cancel_io(winfo, fd, iom, event, ECANCELED);
+            }
+
             sylar::Fiber::GetThis()->yield();
 
-            // 3 resume either by addEvent or cancelEvent
+            // 4 resume either by addEvent or cancelEvent
             if (timer)
             {
                 timer->cancel();
             }
             // by cancelEvent
-            if (tinfo->cancelled == ETIMEDOUT)
+            if (tinfo->cancelled)
             {
                 errno = tinfo->cancelled;
                 return -1;
@@ -193,14 +823,14 @@ extern "C"
             return sleep_f(seconds);
         }
 
-        std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-        sylar::IOManager *iom = sylar::IOManager::GetThis();
-        // add a timer to reschedule this fiber
-        iom->addTimer(seconds * 1000, [fiber, iom]()
-                      { iom->scheduleLock(fiber, -1); });
-        // wait for the next resume
-        fiber->yield();
-        return 0;
+        // cut short -> the seconds not slept, like a signal
+        uint64_t left_ms = 0;
+        int rt = deadline_sleep(seconds * 1000ULL, left_ms);
+        if (rt)
+        {
+            errno = rt;
+        }
+        return (left_ms + 999) / 1000;
     }
 
     int usleep(useconds_t usec)
@@ -210,13 +840,13 @@ extern "C"
             return usleep_f(usec);
         }
 
-        std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-        sylar::IOManager *iom = sylar::IOManager::GetThis();
-        // add a timer to reschedule this fiber
-        iom->addTimer(usec / 1000, [fiber, iom]()
-                      { iom->scheduleLock(fiber); });
-        // wait for the next resume
-        fiber->yield();
+        uint64_t left_ms = 0;
+        int rt = deadline_sleep(usec / 1000, left_ms);
+        if (rt)
+        {
+            errno = rt;
+            return -1;
+        }
         return 0;
     }
 
@@ -227,15 +857,18 @@ extern "C"
             return nanosleep_f(req, rem);
         }
 
-        int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-
-        std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-        sylar::IOManager *iom = sylar::IOManager::GetThis();
-        // add a timer to reschedule this fiber
-        iom->addTimer(timeout_ms, [fiber, iom]()
-                      { iom->scheduleLock(fiber, -1); });
-        // wait for the next resume
-        fiber->yield();
+        uint64_t left_ms = 0;
+        int rt = deadline_sleep(req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000, left_ms);
+        if (rt)
+        {
+            if (rem)
+            {
+                rem->tv_sec = left_ms / 1000;
+                rem->tv_nsec = left_ms % 1000 * 1000000;
+            }
+            errno = rt;
+            return -1;
+        }
         return 0;
     }
 
@@ -246,13 +879,14 @@ extern "C"
             return socket_f(domain, type, protocol);
         }
 
-        int fd = socket_f(domain, type, protocol);
+        // nonblocking from the start -> registered without fstat/fcntl
+        int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
         if (fd == -1)
         {
             std::cerr << "socket() failed:" << strerror(errno) << std::endl;
             return fd;
         }
-        sylar::FdMgr::GetInstance()->get(fd, true);
+        sylar::FdMgr::GetInstance()->addSocket(fd, type & SOCK_NONBLOCK);
         return fd;
     }
 
@@ -292,6 +926,14 @@ extern "C"
             return n;
         }
 
+        // the fiber deadline bounds the connect timeout too
+        timeout_ms = deadline_clamp(timeout_ms);
+        if (timeout_ms == 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
         // wait for write event is ready -> connect succeeds
         sylar::IOManager *iom = sylar::IOManager::GetThis();
         std::shared_ptr<sylar::Timer> timer;
@@ -301,19 +943,19 @@ extern "C"
         if (timeout_ms != (uint64_t)-1)
         {
             timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]()
-                                           {
-            auto t = winfo.lock();
-            if(!t || t->cancelled) 
-            {
-                return;
-            }
-            t->cancelled = ETIMEDOUT;
-            iom->cancelEvent(fd, sylar::IOManager::WRITE); }, winfo);
+                                           { cancel_io(winfo, fd, iom, sylar::IOManager::WRITE, ETIMEDOUT); }, winfo);
         }
 
         int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
         if (rt == 0)
         {
+            sylar::CancelWait cancel_wait([winfo, fd, iom]()
+                                          { cancel_io(winfo, fd, iom, sylar::IOManager::WRITE, ECANCELED); });
+            if (cancel_wait.cancelled())
+            {
+                cancel_io(winfo, fd, iom, sylar::IOManager::WRITE, ECANCELED);
+            }
+
             sylar::Fiber::GetThis()->yield();
 
             // resume either by addEvent or cancelEvent
@@ -363,10 +1005,25 @@ extern "C"
 
     int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
     {
-        int fd = do_io(sockfd, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+        if (!sylar::t_hook_enable)
+        {
+            return accept_f(sockfd, addr, addrlen);
+        }
+        return accept4(sockfd, addr, addrlen, 0);
+    }
+
+    int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+    {
+        if (!sylar::t_hook_enable)
+        {
+            return accept4_f(sockfd, addr, addrlen, flags);
+        }
+
+        // nonblocking from the start -> registered without fstat/fcntl
+        int fd = do_io(sockfd, accept4_f, "accept4", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags | SOCK_NONBLOCK);
         if (fd >= 0)
         {
-            sylar::FdMgr::GetInstance()->get(fd, true);
+            sylar::FdMgr::GetInstance()->addSocket(fd, flags & SOCK_NONBLOCK);
         }
         return fd;
     }
@@ -440,7 +1097,49 @@ extern "C"
             // del fdctx
             sylar::FdMgr::GetInstance()->del(fd);
         }
-        return close_f(fd);
+        return close_f(fd);
+    }
+
+    int dup(int oldfd)
+    {
+        int fd = dup_f(oldfd);
+        if (fd >= 0 && sylar::t_hook_enable)
+        {
+            sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+        }
+        return fd;
+    }
+
+    int dup2(int oldfd, int newfd)
+    {
+        if (!sylar::t_hook_enable)
+        {
+            return dup2_f(oldfd, newfd);
+        }
+
+        dup_release(oldfd, newfd);
+        int fd = dup2_f(oldfd, newfd);
+        if (fd >= 0 && oldfd != newfd)
+        {
+            sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+        }
+        return fd;
+    }
+
+    int dup3(int oldfd, int newfd, int flags)
+    {
+        if (!sylar::t_hook_enable)
+        {
+            return dup3_f(oldfd, newfd, flags);
+        }
+
+        dup_release(oldfd, newfd);
+        int fd = dup3_f(oldfd, newfd, flags);
+        if (fd >= 0)
+        {
+            sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+        }
+        return fd;
     }
 
     int fcntl(int fd, int cmd, ... /* arg */)
@@ -498,6 +1197,18 @@ extern "C"
 
         case F_DUPFD:
         case F_DUPFD_CLOEXEC:
+        {
+            int arg = va_arg(va, int);
+            va_end(va);
+            int newfd = fcntl_f(fd, cmd, arg);
+            if (newfd >= 0 && sylar::t_hook_enable)
+            {
+                sylar::FdMgr::GetInstance()->dup(fd, newfd);
+            }
+            return newfd;
+        }
+        break;
+
         case F_SETFD:
         case F_SETOWN:
         case F_SETSIG:
@@ -597,4 +1308,538 @@ extern "C"
         }
         return setsockopt_f(sockfd, level, optname, optval, optlen);
     }
+
+    ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+    {
+        return do_file_io(fd, pread_f, buf, count, offset);
+    }
+
+    ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+    {
+        return do_file_io(fd, pwrite_f, buf, count, offset);
+    }
+
+    ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+    {
+        return do_file_io(fd, preadv_f, iov, iovcnt, offset);
+    }
+
+    ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+    {
+        return do_file_io(fd, pwritev_f, iov, iovcnt, offset);
+    }
+
+    int fsync(int fd)
+    {
+        return do_file_io(fd, fsync_f);
+    }
+
+    int fdatasync(int fd)
+    {
+        return do_file_io(fd, fdatasync_f);
+    }
+
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+    {
+        if (!sylar::t_hook_enable || !sylar::IOManager::GetThis())
+        {
+            return poll_f(fds, nfds, timeout);
+        }
+
+        return do_poll(fds, nfds, timeout);
+    }
+
+    int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask)
+    {
+        // a signal mask can't be swapped atomically around a parked fiber -> blocking call
+        if (!sylar::t_hook_enable || !sylar::IOManager::GetThis() || sigmask)
+        {
+            return ppoll_f(fds, nfds, tmo_p, sigmask);
+        }
+
+        int timeout_ms = tmo_p ? tmo_p->tv_sec * 1000 + (tmo_p->tv_nsec + 999999) / 1000000 : -1;
+        return do_poll(fds, nfds, timeout_ms);
+    }
+
+    int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout)
+    {
+        if (!sylar::t_hook_enable || !sylar::IOManager::GetThis())
+        {
+            return select_f(nfds, readfds, writefds, exceptfds, timeout);
+        }
+
+        // fd_set -> pollfd
+        std::vector<struct pollfd> fds;
+        for (int fd = 0; fd < nfds; ++fd)
+        {
+            short events = 0;
+            if (readfds && FD_ISSET(fd, readfds))
+            {
+                events |= POLLIN;
+            }
+            if (writefds && FD_ISSET(fd, writefds))
+            {
+                events |= POLLOUT;
+            }
+            if (exceptfds && FD_ISSET(fd, exceptfds))
+            {
+                events |= POLLPRI;
+            }
+            if (events)
+            {
+                fds.push_back({fd, events, 0});
+            }
+        }
+
+        int timeout_ms = timeout ? timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000 : -1;
+        uint64_t start = now_ms();
+        int rt = do_poll(fds.data(), fds.size(), timeout_ms);
+        if (rt < 0)
+        {
+            return rt;
+        }
+
+        // like Linux, leave the time not slept in timeout
+        if (timeout)
+        {
+            uint64_t elapsed = now_ms() - start;
+            uint64_t left = (uint64_t)timeout_ms > elapsed ? timeout_ms - elapsed : 0;
+            timeout->tv_sec = left / 1000;
+            timeout->tv_usec = left % 1000 * 1000;
+        }
+
+        // pollfd -> fd_set, counting every bit set
+        for (auto &pfd : fds)
+        {
+            if (pfd.revents & POLLNVAL)
+            {
+                errno = EBADF;
+                return -1;
+            }
+        }
+        rt = 0;
+        for (auto &pfd : fds)
+        {
+            if (readfds && FD_ISSET(pfd.fd, readfds) && !(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                FD_CLR(pfd.fd, readfds);
+            }
+            if (writefds && FD_ISSET(pfd.fd, writefds) && !(pfd.revents & (POLLOUT | POLLERR)))
+            {
+                FD_CLR(pfd.fd, writefds);
+            }
+            if (exceptfds && FD_ISSET(pfd.fd, exceptfds) && !(pfd.revents & POLLPRI))
+            {
+                FD_CLR(pfd.fd, exceptfds);
+            }
+            rt += (readfds && FD_ISSET(pfd.fd, readfds)) + (writefds && FD_ISSET(pfd.fd, writefds)) +
+                  (exceptfds && FD_ISSET(pfd.fd, exceptfds));
+        }
+        return rt;
+    }
+
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+    {
+        if (!sylar::t_hook_enable || !sylar::IOManager::GetThis())
+        {
+            return epoll_wait_f(epfd, events, maxevents, timeout);
+        }
+
+        int rt = epoll_wait_f(epfd, events, maxevents, 0);
+        if (rt != 0 || timeout == 0)
+        {
+            return rt;
+        }
+
+        // an epoll fd is readable while it has ready events -> wait for that, then collect them
+        uint64_t deadline = timeout < 0 ? (uint64_t)-1 : now_ms() + timeout;
+        while (true)
+        {
+            struct pollfd pfd = {epfd, POLLIN, 0};
+            int left = -1;
+            if (deadline != (uint64_t)-1)
+            {
+                uint64_t now = now_ms();
+                left = deadline > now ? deadline - now : 0;
+            }
+
+            rt = do_poll(&pfd, 1, left);
+            if (rt < 0)
+            {
+                return rt;
+            }
+
+            // another waiter may have taken the events first -> wait again until the deadline
+            rt = epoll_wait_f(epfd, events, maxevents, 0);
+            if (rt != 0 || left == 0 || (deadline != (uint64_t)-1 && now_ms() >= deadline))
+            {
+                return rt;
+            }
+        }
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t *mutex)
+    {
+        // other libraries may lock before the static initialisation of this file
+        if (!pthread_mutex_lock_f)
+        {
+            sylar::hook_init();
+        }
+        // disabled -> no bookkeeping at all, every lock in the process passes through here
+        if (!sylar::s_pthread_hook_enable)
+        {
+            return pthread_mutex_lock_f(mutex);
+        }
+
+        sylar::Fiber *task = pthread_parkable(0);
+        if (!task)
+        {
+            int rt = pthread_mutex_lock_f(mutex);
+            if (rt == 0 && (task = pthread_task()))
+            {
+                ++task->m_hookedLocks;
+            }
+            return rt;
+        }
+
+        // contended -> park until an unlock, then try again
+        // trying once more after queueing up -> an unlock in between is not missed
+        // a thread's cond wait releases the mutex past the unlock hook -> lock it the blocking way meanwhile, the holder is about to let go
+        // the hook disabled meanwhile -> nobody wakes parked fibers any more, block as well
+        int rt = pthread_mutex_trylock_f(mutex);
+        bool block = false;
+        while (rt == EBUSY)
+        {
+            if (!sylar::s_pthread_hook_enable)
+            {
+                return pthread_mutex_lock_f(mutex);
+            }
+            park_wait(mutex, (uint64_t)-1, [&]()
+                      {
+                rt = pthread_mutex_trylock_f(mutex);
+                block = rt == EBUSY && cond_released(mutex);
+                return rt != EBUSY || block; });
+            if (block)
+            {
+                rt = pthread_mutex_lock_f(mutex);
+                break;
+            }
+            if (rt == EBUSY)
+            {
+                rt = pthread_mutex_trylock_f(mutex);
+            }
+        }
+        if (rt == 0)
+        {
+            // the fiber may have moved to another thread
+            ++sylar::Scheduler::GetRunningTask()->m_hookedLocks;
+        }
+        return rt;
+    }
+
+    // counted like pthread_mutex_lock() -> the unlock stays symmetric
+    int pthread_mutex_trylock(pthread_mutex_t *mutex)
+    {
+        if (!pthread_mutex_trylock_f)
+        {
+            sylar::hook_init();
+        }
+        if (!sylar::s_pthread_hook_enable)
+        {
+            return pthread_mutex_trylock_f(mutex);
+        }
+
+        int rt = pthread_mutex_trylock_f(mutex);
+        sylar::Fiber *task = nullptr;
+        if (rt == 0 && (task = pthread_task()))
+        {
+            ++task->m_hookedLocks;
+        }
+        return rt;
+    }
+
+    int pthread_mutex_unlock(pthread_mutex_t *mutex)
+    {
+        if (!pthread_mutex_unlock_f)
+        {
+            sylar::hook_init();
+        }
+        if (!sylar::s_pthread_hook_enable)
+        {
+            return pthread_mutex_unlock_f(mutex);
+        }
+
+        int rt = pthread_mutex_unlock_f(mutex);
+        if (rt)
+        {
+            return rt;
+        }
+
+        sylar::Fiber *task = pthread_task();
+        if (task && task->m_hookedLocks > 0)
+        {
+            --task->m_hookedLocks;
+        }
+        if (s_parked_count > 0)
+        {
+            unpark_wake(mutex, false);
+        }
+        return 0;
+    }
+
+    int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+    {
+        if (!pthread_parkable(1))
+        {
+            return thread_cond_wait(mutex, [&]()
+                                    { return pthread_cond_wait_f(cond, mutex); });
+        }
+        return do_cond_wait(cond, mutex, CLOCK_REALTIME, nullptr);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+    {
+        // the clock set by pthread_condattr_setclock() can't be read back -> CLOCK_REALTIME is assumed
+        if (!pthread_parkable(1))
+        {
+            return thread_cond_wait(mutex, [&]()
+                                    { return pthread_cond_timedwait_f(cond, mutex, abstime); });
+        }
+        return do_cond_wait(cond, mutex, CLOCK_REALTIME, abstime);
+    }
+
+    int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clockid, const struct timespec *abstime)
+    {
+        if (!pthread_parkable(1))
+        {
+            return thread_cond_wait(mutex, [&]()
+                                    { return pthread_cond_clockwait_f(cond, mutex, clockid, abstime); });
+        }
+        return do_cond_wait(cond, mutex, clockid, abstime);
+    }
+
+    // a thread and a fiber may both wake up for one signal -> allowed as a spurious wakeup
+    int pthread_cond_signal(pthread_cond_t *cond)
+    {
+        int rt = pthread_cond_signal_f(cond);
+        if (s_parked_count > 0)
+        {
+            unpark_wake(cond, false);
+        }
+        return rt;
+    }
+
+    int pthread_cond_broadcast(pthread_cond_t *cond)
+    {
+        int rt = pthread_cond_broadcast_f(cond);
+        if (s_parked_count > 0)
+        {
+            unpark_wake(cond, true);
+        }
+        return rt;
+    }
+
+    int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res)
+    {
+        if (!sylar::t_hook_enable || node == nullptr)
+        {
+            return getaddrinfo_f(node, service, hints, res);
+        }
+
+        int flags = hints ? hints->ai_flags : 0;
+        int family = hints ? hints->ai_family : AF_UNSPEC;
+        sylar::Resolver *resolver = sylar::Resolver::GetInstance();
+        auto blocking = [=]()
+        {
+            return sylar::await_blocking([=]()
+                                         { return getaddrinfo_f(node, service, hints, res); });
+        };
+        // numeric host, canonical name, other families, search domains or NSS sources besides files/dns
+        // -> the original one, off the worker thread
+        sockaddr_storage numeric;
+        if ((flags & (AI_NUMERICHOST | AI_CANONNAME)) || (family != AF_UNSPEC && family != AF_INET && family != AF_INET6) ||
+            inet_pton(AF_INET, node, &numeric) == 1 || inet_pton(AF_INET6, node, &numeric) == 1 || !resolver->canResolve(node))
+        {
+            return blocking();
+        }
+
+        // the port -> without a node the original one only reads /etc/services
+        uint16_t port = 0;
+        if (service)
+        {
+            addrinfo port_hints = {};
+            port_hints.ai_family = family;
+            port_hints.ai_socktype = hints ? hints->ai_socktype : 0;
+            port_hints.ai_protocol = hints ? hints->ai_protocol : 0;
+            port_hints.ai_flags = flags & AI_NUMERICSERV;
+            addrinfo *service_res = nullptr;
+            int rt = getaddrinfo_f(nullptr, service, &port_hints, &service_res);
+            if (rt)
+            {
+                return rt;
+            }
+            // sin_port and sin6_port share the offset
+            port = ((sockaddr_in *)service_res->ai_addr)->sin_port;
+            freeaddrinfo(service_res);
+        }
+
+        std::vector<sockaddr_storage> addrs;
+        int rt = resolver->resolve(node, family, addrs);
+        if (rt == EAI_AGAIN)
+        {
+            // the servers don't answer -> the original one wouldn't either
+            return rt;
+        }
+        if (rt)
+        {
+            // the search domains may still find it
+            return blocking();
+        }
+
+        // no socket type -> one entry per type, like glibc
+        std::vector<std::pair<int, int>> types;
+        if (hints && hints->ai_socktype)
+        {
+            types.push_back({hints->ai_socktype, hints->ai_protocol});
+        }
+        else
+        {
+            types = {{SOCK_STREAM, IPPROTO_TCP}, {SOCK_DGRAM, IPPROTO_UDP}, {SOCK_RAW, 0}};
+        }
+
+        // each entry and its address in one block -> freeaddrinfo() releases them
+        addrinfo *head = nullptr;
+        addrinfo **tail = &head;
+        for (const sockaddr_storage &addr : addrs)
+        {
+            socklen_t addrlen = addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+            for (const auto &type : types)
+            {
+                addrinfo *ai = (addrinfo *)calloc(1, sizeof(addrinfo) + sizeof(sockaddr_in6));
+                if (ai == nullptr)
+                {
+                    freeaddrinfo(head);
+                    return EAI_MEMORY;
+                }
+                ai->ai_family = addr.ss_family;
+                ai->ai_socktype = type.first;
+                ai->ai_protocol = type.second;
+                ai->ai_addrlen = addrlen;
+                ai->ai_addr = (sockaddr *)(ai + 1);
+                memcpy(ai->ai_addr, &addr, addrlen);
+                ((sockaddr_in *)ai->ai_addr)->sin_port = port;
+
+                *tail = ai;
+                tail = &ai->ai_next;
+            }
+        }
+        *res = head;
+        return 0;
+    }
 }
+
+namespace sylar
+{
+
+    int accept_batch(int sockfd, std::vector<int> &clients, size_t max_batch, int flags)
+    {
+        // park until the first connection is ready
+        int fd = accept4(sockfd, nullptr, nullptr, flags);
+        if (fd == -1)
+        {
+            return -1;
+        }
+        clients.push_back(fd);
+
+        int count = 1;
+        if (!t_hook_enable)
+        {
+            return count;
+        }
+
+        // drain the backlog without parking again
+        while ((size_t)count < max_batch)
+        {
+            fd = accept4_f(sockfd, nullptr, nullptr, flags | SOCK_NONBLOCK);
+            if (fd == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // EAGAIN -> drained, other errors show up on the next call
+                break;
+            }
+            FdMgr::GetInstance()->addSocket(fd, flags & SOCK_NONBLOCK);
+            clients.push_back(fd);
+            ++count;
+        }
+        return count;
+    }
+
+    ssize_t sendmsg_zerocopy(int sockfd, const struct msghdr *msg, int flags, std::function<void()> on_release)
+    {
+        IOManager *iom = IOManager::GetThis();
+        std::shared_ptr<FdCtx> ctx = FdMgr::GetInstance()->get(sockfd);
+        // not on the fiber path or SO_ZEROCOPY unsupported -> ordinary copying send
+        if (!t_hook_enable || !iom || !ctx || ctx->isClosed() || !ctx->enableZeroCopy())
+        {
+            ssize_t n = sendmsg(sockfd, msg, flags);
+            if (n >= 0 && on_release)
+            {
+                on_release();
+            }
+            return n;
+        }
+
+        uint32_t seq = 0;
+        ssize_t n = do_io(
+            sockfd, [&](int, const struct msghdr *m, int f)
+            { return ctx->sendZeroCopy(m, f, seq); },
+            "sendmsg_zerocopy", IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+        if (n == -1 && errno == ENOBUFS)
+        {
+            // out of optmem for pinning pages -> copy this one
+            n = sendmsg(sockfd, msg, flags);
+            if (n >= 0 && on_release)
+            {
+                on_release();
+            }
+            return n;
+        }
+        // nothing queued -> no number, nothing pinned
+        if (n <= 0)
+        {
+            if (n == 0 && on_release)
+            {
+                on_release();
+            }
+            return n;
+        }
+
+        int rt = iom->addZeroCopyEvent(sockfd, seq, on_release);
+        if (rt == 0 && !on_release)
+        {
+            // resume by the completion notification or by close()
+            Fiber::GetThis()->yield();
+        }
+        else if (rt == -1)
+        {
+            std::cerr << "sendmsg_zerocopy addZeroCopyEvent(" << sockfd << ", " << seq << ") error" << std::endl;
+        }
+        return n;
+    }
+
+    ssize_t send_zerocopy(int sockfd, const void *buf, size_t len, int flags, std::function<void()> on_release)
+    {
+        iovec iov;
+        iov.iov_base = const_cast<void *>(buf);
+        iov.iov_len = len;
+
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        return sendmsg_zerocopy(sockfd, &msg, flags, std::move(on_release));
+    }
+
+} // end namespace sylar
@@ -2,18 +2,83 @@
 #define _HOOK_H_
 
 #include <fcntl.h>
+#include <functional>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 namespace sylar
 {
+    class Fiber;
+
     // 判断钩子功能是否启用
     bool is_hook_enable();
     // 设置钩子功能的启用/禁用状态
     void set_hook_enable(bool flag);
+
+    // 整个进程：任务协程中竞争的pthread互斥锁、条件变量等待改为挂起协程(需要IOManager)，默认关闭
+    // 只适用于普通互斥锁：锁的所有者是线程，同一线程上的协程对递归锁不互斥
+    // 运行时自身的锁不受影响，见RuntimeScope
+    // 关闭时互斥锁钩子直接调用原函数，不做任何计数；关闭会唤醒已挂起的协程，它们改为阻塞线程
+    // 开启应在任务协程不持有pthread互斥锁时进行(例如IOManager启动之前)：关闭期间加的锁没有计数
+    bool is_pthread_hook_enable();
+    void set_pthread_hook_enable(bool flag);
+
+    // 任务协程的截止时间：作用域内钩子的connect、读写、poll/select、sleep共享一个绝对截止时间
+    // 到期后需要等待的操作返回-1且errno为ETIMEDOUT(poll返回0)；fd的超时仍然有效，取较早者
+    // sleep系列被截止时间截断(包括调用时已经到期)和被信号中断一样：sleep返回剩余秒数，usleep/nanosleep为EINTR(及rem)
+    // 被取消 -> errno为ECANCELED；遇到EINTR重试的循环需要自己检查deadline_remaining()
+    // 嵌套时取较早者，析构时恢复之前的截止时间；不在任务协程中 -> 无效果
+    class DeadlineScope
+    {
+    public:
+        // absolute -> ms是get_deadline()返回的时间点，例如交给子协程的截止时间；否则为从现在开始的毫秒数
+        explicit DeadlineScope(uint64_t ms, bool absolute = false);
+        ~DeadlineScope();
+
+        DeadlineScope(const DeadlineScope &) = delete;
+        DeadlineScope &operator=(const DeadlineScope &) = delete;
+
+    private:
+        Fiber *m_fiber = nullptr;
+        uint64_t m_prev = (uint64_t)-1;
+    };
+
+    // 当前协程的截止时间(steady_clock毫秒)，-1 -> 没有
+    uint64_t get_deadline();
+    // 距离截止时间的毫秒数，-1 -> 没有截止时间，0 -> 已到期
+    uint64_t deadline_remaining();
+
+    // 运行时自身的加锁：调度器队列、fd上下文、协程同步原语等内部的std::mutex同样经过pthread钩子
+    // 作用域内这些调用直接进入原函数，不挂起协程、也不计入协程持有的锁；计数记在任务协程上 -> 作用域内可以挂起
+    class RuntimeScope
+    {
+    public:
+        RuntimeScope();
+        ~RuntimeScope();
+
+        RuntimeScope(const RuntimeScope &) = delete;
+        RuntimeScope &operator=(const RuntimeScope &) = delete;
+
+    private:
+        Fiber *m_fiber = nullptr;
+    };
+
+    // 批量accept：挂起直到监听套接字就绪，然后一次取尽积压的连接(最多max_batch个)，返回取到的连接数，出错返回-1
+    int accept_batch(int sockfd, std::vector<int> &clients, size_t max_batch = 64, int flags = SOCK_CLOEXEC);
+
+    // 零拷贝发送(MSG_ZEROCOPY)，返回已发送的字节数
+    // on_release为空 -> 挂起当前协程直到内核释放buf的页面；否则立即返回，页面释放后调度on_release
+    ssize_t send_zerocopy(int sockfd, const void *buf, size_t len, int flags, std::function<void()> on_release = nullptr);
+    ssize_t sendmsg_zerocopy(int sockfd, const struct msghdr *msg, int flags, std::function<void()> on_release = nullptr);
 }
 
 // 确保正确调用C库中的系统调用，C++编译器不会对这些函数名进行修饰
@@ -38,6 +103,9 @@ extern "C"
     typedef int (*accept_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
     extern accept_fun accept_f;
 
+    typedef int (*accept4_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+    extern accept4_fun accept4_f;
+
     typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
     extern read_fun read_f;
 
@@ -71,6 +139,15 @@ extern "C"
     typedef int (*close_fun)(int fd);
     extern close_fun close_f;
 
+    typedef int (*dup_fun)(int oldfd);
+    extern dup_fun dup_f;
+
+    typedef int (*dup2_fun)(int oldfd, int newfd);
+    extern dup2_fun dup2_f;
+
+    typedef int (*dup3_fun)(int oldfd, int newfd, int flags);
+    extern dup3_fun dup3_f;
+
     typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */);
     extern fcntl_fun fcntl_f;
 
@@ -83,6 +160,63 @@ extern "C"
     typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
     extern setsockopt_fun setsockopt_f;
 
+    typedef int (*getaddrinfo_fun)(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+    extern getaddrinfo_fun getaddrinfo_f;
+
+    typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+    extern pread_fun pread_f;
+
+    typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+    extern pwrite_fun pwrite_f;
+
+    typedef ssize_t (*preadv_fun)(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+    extern preadv_fun preadv_f;
+
+    typedef ssize_t (*pwritev_fun)(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+    extern pwritev_fun pwritev_f;
+
+    typedef int (*fsync_fun)(int fd);
+    extern fsync_fun fsync_f;
+
+    typedef int (*fdatasync_fun)(int fd);
+    extern fdatasync_fun fdatasync_f;
+
+    typedef int (*poll_fun)(struct pollfd *fds, nfds_t nfds, int timeout);
+    extern poll_fun poll_f;
+
+    typedef int (*ppoll_fun)(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask);
+    extern ppoll_fun ppoll_f;
+
+    typedef int (*select_fun)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+    extern select_fun select_f;
+
+    typedef int (*epoll_wait_fun)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+    extern epoll_wait_fun epoll_wait_f;
+
+    typedef int (*pthread_mutex_lock_fun)(pthread_mutex_t *mutex);
+    extern pthread_mutex_lock_fun pthread_mutex_lock_f;
+
+    typedef int (*pthread_mutex_trylock_fun)(pthread_mutex_t *mutex);
+    extern pthread_mutex_trylock_fun pthread_mutex_trylock_f;
+
+    typedef int (*pthread_mutex_unlock_fun)(pthread_mutex_t *mutex);
+    extern pthread_mutex_unlock_fun pthread_mutex_unlock_f;
+
+    typedef int (*pthread_cond_wait_fun)(pthread_cond_t *cond, pthread_mutex_t *mutex);
+    extern pthread_cond_wait_fun pthread_cond_wait_f;
+
+    typedef int (*pthread_cond_timedwait_fun)(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
+    extern pthread_cond_timedwait_fun pthread_cond_timedwait_f;
+
+    typedef int (*pthread_cond_clockwait_fun)(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clockid, const struct timespec *abstime);
+    extern pthread_cond_clockwait_fun pthread_cond_clockwait_f;
+
+    typedef int (*pthread_cond_signal_fun)(pthread_cond_t *cond);
+    extern pthread_cond_signal_fun pthread_cond_signal_f;
+
+    typedef int (*pthread_cond_broadcast_fun)(pthread_cond_t *cond);
+    extern pthread_cond_broadcast_fun pthread_cond_broadcast_f;
+
     // function prototype -> 对应.h中已经存在 可以省略
     // sleep function
     unsigned int sleep(unsigned int seconds);
@@ -93,6 +227,7 @@ extern "C"
     int socket(int domain, int type, int protocol);
     int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
     int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+    int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 
     // read
     ssize_t read(int fd, void *buf, size_t count);
@@ -112,6 +247,10 @@ extern "C"
 
     // fd
     int close(int fd);
+    // the new fd inherits the FdCtx, the fd replaced by dup2()/dup3() is torn down like close()
+    int dup(int oldfd);
+    int dup2(int oldfd, int newfd);
+    int dup3(int oldfd, int newfd, int flags);
 
     // socket control
     int fcntl(int fd, int cmd, ... /* arg */);
@@ -119,5 +258,32 @@ extern "C"
 
     int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen);
     int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+
+    // dns -> sylar::Resolver
+    int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+
+    // file io -> sylar::BlockingPool
+    ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+    ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+    ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+    ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+    int fsync(int fd);
+    int fdatasync(int fd);
+
+    // readiness waits -> IOManager::addEvent on every fd of the set
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+    int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask);
+    int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+
+    // pthread waits -> park the fiber, see sylar::set_pthread_hook_enable()
+    int pthread_mutex_lock(pthread_mutex_t *mutex);
+    int pthread_mutex_trylock(pthread_mutex_t *mutex);
+    int pthread_mutex_unlock(pthread_mutex_t *mutex);
+    int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+    int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
+    int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clockid, const struct timespec *abstime);
+    int pthread_cond_signal(pthread_cond_t *cond);
+    int pthread_cond_broadcast(pthread_cond_t *cond);
 }
 #endif //!_HOOK_H_
@@ -2,6 +2,9 @@
 #include <sys/epoll.h>
 #include <fcntl.h>
 #include <cstring>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <poll.h>
 
 #include "ioscheduler.h"
 
@@ -24,6 +27,8 @@ namespace sylar
             return read;
         case WRITE:
             return write;
+        default:
+            break;
         }
         throw std::invalid_argument("Unsupported event type");
     }
@@ -33,6 +38,7 @@ namespace sylar
         ctx.scheduler = nullptr;
         ctx.fiber.reset();
         ctx.cb = nullptr;
+        ctx.owner = nullptr;
     }
 
     // no lock
@@ -61,8 +67,91 @@ namespace sylar
         return;
     }
 
-    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name) : Scheduler(threads, use_caller, name), TimerManager()
+    // no lock
+    void IOManager::FdContext::drainZeroCopy()
+    {
+        char control[128];
+        while (true)
+        {
+            msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            // the original recvmsg -> the hooked one would park the calling fiber on EAGAIN
+            int rt = recvmsg_f(fd, &msg, MSG_ERRQUEUE);
+            if (rt < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // EAGAIN -> error queue exhausted
+                break;
+            }
+
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                    !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                {
+                    continue;
+                }
+
+                sock_extended_err *serr = (sock_extended_err *)CMSG_DATA(cm);
+                if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                {
+                    continue;
+                }
+
+                // one notification covers the sends numbered [ee_info, ee_data], which may wrap
+                uint64_t lo = zerocopy.widen(serr->ee_info);
+                uint64_t &hi = zerocopy.ranges[lo];
+                hi = std::max(hi, lo + (uint32_t)(serr->ee_data - serr->ee_info));
+            }
+        }
+
+        // merge the ranges that continue the released prefix
+        auto it = zerocopy.ranges.begin();
+        while (it != zerocopy.ranges.end() && it->first <= zerocopy.completed)
+        {
+            zerocopy.completed = std::max(zerocopy.completed, it->second + 1);
+            it = zerocopy.ranges.erase(it);
+        }
+    }
+
+    // no lock
+    size_t IOManager::FdContext::triggerZeroCopy(bool all)
+    {
+        size_t count = 0;
+        auto it = zerocopy.waiters.begin();
+        while (it != zerocopy.waiters.end() && (all || it->first < zerocopy.completed))
+        {
+            EventContext &ctx = it->second;
+            if (ctx.cb)
+            {
+                ctx.scheduler->scheduleLock(&ctx.cb);
+            }
+            else
+            {
+                ctx.scheduler->scheduleLock(&ctx.fiber);
+            }
+            it = zerocopy.waiters.erase(it);
+            ++count;
+        }
+
+        if (zerocopy.waiters.empty())
+        {
+            events = (Event)(events & ~ZEROCOPY);
+        }
+        return count;
+    }
+
+    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, const IdlePolicy &policy,
+                         const std::vector<std::vector<int>> &cpus) : Scheduler(threads, use_caller, name), TimerManager()
     {
+        setIdlePolicy(policy);
+        setWorkerCpus(cpus);
+
         // create epoll fd
         m_epfd = epoll_create(5000);
         assert(m_epfd > 0);
@@ -119,7 +208,7 @@ namespace sylar
         }
     }
 
-    int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
+    int IOManager::addEvent(int fd, Event event, std::function<void()> cb, const void *owner)
     {
         // attemp to find FdContext
         FdContext *fd_ctx = nullptr;
@@ -138,6 +227,7 @@ namespace sylar
             fd_ctx = m_fdContexts[fd];
         }
 
+        RuntimeScope scope;
         std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
         // the event has already been added
@@ -146,6 +236,16 @@ namespace sylar
             return -1;
         }
 
+        // busy polling mode -> let the socket poll its device queue too, best effort:
+        // raising it above net.core.busy_read needs CAP_NET_ADMIN and non-sockets refuse it
+        uint32_t busy_poll_us = getIdlePolicy().socketBusyPollUs;
+        if (getIdlePolicy().busyPoll && busy_poll_us && !fd_ctx->busyPoll)
+        {
+            int us = (int)busy_poll_us;
+            setsockopt_f(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us));
+            fd_ctx->busyPoll = true;
+        }
+
         // add new event
         int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
         epoll_event epevent;
@@ -155,7 +255,11 @@ namespace sylar
         int rt = epoll_ctl(m_epfd, op, fd, &epevent);
         if (rt)
         {
-            std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
+            // EPERM -> the fd doesn't support epoll (regular files), the caller handles it
+            if (errno != EPERM)
+            {
+                std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
+            }
             return -1;
         }
 
@@ -168,6 +272,7 @@ namespace sylar
         FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
         assert(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
         event_ctx.scheduler = Scheduler::GetThis();
+        event_ctx.owner = owner;
         if (cb)
         {
             event_ctx.cb.swap(cb);
@@ -180,7 +285,7 @@ namespace sylar
         return 0;
     }
 
-    bool IOManager::delEvent(int fd, Event event)
+    bool IOManager::delEvent(int fd, Event event, const void *owner)
     {
         // attemp to find FdContext
         FdContext *fd_ctx = nullptr;
@@ -197,6 +302,7 @@ namespace sylar
             return false;
         }
 
+        RuntimeScope scope;
         std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
         // the event doesn't exist
@@ -204,6 +310,10 @@ namespace sylar
         {
             return false;
         }
+        if (owner && fd_ctx->getEventContext(event).owner != owner)
+        {
+            return false;
+        }
 
         // delete the event
         Event new_events = (Event)(fd_ctx->events & ~event);
@@ -247,6 +357,7 @@ namespace sylar
             return false;
         }
 
+        RuntimeScope scope;
         std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
         // the event doesn't exist
@@ -293,8 +404,14 @@ namespace sylar
             return false;
         }
 
+        RuntimeScope scope;
         std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
+        // cancelAll is issued by close() -> the next socket on this fd counts zero-copy sends from 0
+        fd_ctx->zerocopy.completed = 0;
+        fd_ctx->zerocopy.ranges.clear();
+        fd_ctx->busyPoll = false;
+
         // none of events exist
         if (!fd_ctx->events)
         {
@@ -327,18 +444,90 @@ namespace sylar
             --m_pendingEventCount;
         }
 
+        if (fd_ctx->events & ZEROCOPY)
+        {
+            m_pendingEventCount -= fd_ctx->triggerZeroCopy(true);
+        }
+
         assert(fd_ctx->events == 0);
         return true;
     }
 
+    int IOManager::addZeroCopyEvent(int fd, uint32_t seq, std::function<void()> cb)
+    {
+        // attemp to find FdContext
+        FdContext *fd_ctx = nullptr;
+
+        std::shared_lock<std::shared_mutex> read_lock(m_mutex);
+        if ((int)m_fdContexts.size() > fd)
+        {
+            fd_ctx = m_fdContexts[fd];
+            read_lock.unlock();
+        }
+        else
+        {
+            read_lock.unlock();
+            std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+            contextResize(fd * 1.5);
+            fd_ctx = m_fdContexts[fd];
+        }
+
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+        // the notification may have been queued before anyone waited for it
+        fd_ctx->drainZeroCopy();
+        uint64_t key = fd_ctx->zerocopy.widen(seq);
+        if (key < fd_ctx->zerocopy.completed)
+        {
+            if (cb)
+            {
+                Scheduler::GetThis()->scheduleLock(&cb);
+            }
+            return 1;
+        }
+
+        // EPOLLERR is always reported -> only make sure the fd stays in the epoll set
+        if (!(fd_ctx->events & ZEROCOPY))
+        {
+            int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            epoll_event epevent;
+            epevent.events = (uint32_t)EPOLLET | fd_ctx->events | ZEROCOPY;
+            epevent.data.ptr = fd_ctx;
+
+            // errno is left to the caller, e.g. EBADF after a racing close()
+            if (epoll_ctl(m_epfd, op, fd, &epevent))
+            {
+                return -1;
+            }
+            fd_ctx->events = (Event)(fd_ctx->events | ZEROCOPY);
+        }
+
+        ++m_pendingEventCount;
+
+        FdContext::EventContext event_ctx;
+        event_ctx.scheduler = Scheduler::GetThis();
+        if (cb)
+        {
+            event_ctx.cb.swap(cb);
+        }
+        else
+        {
+            event_ctx.fiber = Fiber::GetThis();
+            assert(event_ctx.fiber->getState() == Fiber::RUNNING);
+        }
+        fd_ctx->zerocopy.waiters.emplace(key, std::move(event_ctx));
+        return 0;
+    }
+
     void IOManager::tickle()
     {
-        // no idle threads
-        if (!hasIdleThreads())
+        // no idle threads, or they are busy polling and never block
+        if (!hasIdleThreads() || getIdlePolicy().busyPoll)
         {
             return;
         }
-        int rt = write(m_tickleFds[1], "T", 1);
+        int rt = write_f(m_tickleFds[1], "T", 1);
         assert(rt == 1);
     }
 
@@ -354,6 +543,10 @@ namespace sylar
         static const uint64_t MAX_EVNETS = 256;
         std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVNETS]);
 
+        // an elastic worker exits once it has found nothing to do for retire_ms, counted across the capped epoll waits
+        uint64_t retire_ms = retireAfterMs();
+        uint64_t idle_since = NowMs();
+
         while (true)
         {
             if (debug)
@@ -363,18 +556,52 @@ namespace sylar
             {
                 if (debug)
                     std::cout << "name = " << getName() << " idle exits in thread: " << Thread::GetThreadId() << std::endl;
+                // the tickles of stop() may have woken only some of the workers -> pass it on
+                tickle();
                 break;
             }
 
-            // blocked at epoll_wait
             int rt = 0;
-            while (true)
+            bool ready = false;
+            if (getIdlePolicy().busyPoll)
+            {
+                // busy polling -> never block in the kernel, false only when stopping
+                ready = idleBusyPoll([&]()
+                                     {
+                                         rt = epoll_wait_f(m_epfd, events.get(), MAX_EVNETS, 0);
+                                         return rt > 0 || getNextTimer() == 0; });
+                if (!ready)
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                // spin, then poll epoll without blocking
+                ready = idleSpin([&]()
+                                 {
+                                     rt = epoll_wait_f(m_epfd, events.get(), MAX_EVNETS, 0);
+                                     return rt > 0; });
+            }
+            if (rt < 0)
+            {
+                rt = 0;
+            }
+
+            // blocked at epoll_wait
+            bool retire = false;
+            while (!ready)
             {
                 static const uint64_t MAX_TIMEOUT = 5000;
                 uint64_t next_timeout = getNextTimer();
                 next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+                if (retire_ms)
+                {
+                    uint64_t idle_ms = NowMs() - idle_since;
+                    next_timeout = std::min(next_timeout, retire_ms > idle_ms ? retire_ms - idle_ms : 0);
+                }
 
-                rt = epoll_wait(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
+                rt = epoll_wait_f(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
                 // EINTR -> retry
                 if (rt < 0 && errno == EINTR)
                 {
@@ -382,6 +609,8 @@ namespace sylar
                 }
                 else
                 {
+                    idleBlocked();
+                    retire = retire_ms && rt == 0 && NowMs() - idle_since >= retire_ms;
                     break;
                 }
             };
@@ -389,6 +618,16 @@ namespace sylar
             // collect all timers overdue
             std::vector<std::function<void()>> cbs;
             listExpiredCb(cbs);
+            if (retire && cbs.empty() && tryRetire())
+            {
+                if (debug)
+                    std::cout << "name = " << getName() << " elastic worker retires in thread: " << Thread::GetThreadId() << std::endl;
+                break;
+            }
+            if (ready || rt > 0 || !cbs.empty())
+            {
+                idle_since = NowMs();
+            }
             if (!cbs.empty())
             {
                 for (const auto &cb : cbs)
@@ -408,7 +647,7 @@ namespace sylar
                 {
                     uint8_t dummy[256];
                     // edge triggered -> exhaust
-                    while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
+                    while (read_f(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
                         ;
                     continue;
                 }
@@ -417,8 +656,21 @@ namespace sylar
                 FdContext *fd_ctx = (FdContext *)event.data.ptr;
                 std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
-                // convert EPOLLERR or EPOLLHUP to -> read or write event
-                if (event.events & (EPOLLERR | EPOLLHUP))
+                // zero-copy completions are queued on the error queue and reported as EPOLLERR
+                bool zerocopy_done = false;
+                bool socket_error = event.events & EPOLLERR;
+                if ((event.events & EPOLLERR) && (fd_ctx->events & ZEROCOPY))
+                {
+                    fd_ctx->drainZeroCopy();
+                    m_pendingEventCount -= fd_ctx->triggerZeroCopy();
+                    zerocopy_done = !(fd_ctx->events & ZEROCOPY);
+                    // the error queue is empty now -> POLLERR only for a real socket error
+                    pollfd pfd = {fd_ctx->fd, 0, 0};
+                    socket_error = poll_f(&pfd, 1, 0) > 0 && (pfd.revents & POLLERR);
+                }
+
+                // convert a socket error or EPOLLHUP to -> read or write event
+                if (socket_error || (event.events & EPOLLHUP))
                 {
                     event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
                 }
@@ -435,6 +687,16 @@ namespace sylar
 
                 if ((fd_ctx->events & real_events) == NONE)
                 {
+                    // no zero-copy waiters left -> keep epoll in sync with the remaining events
+                    if (zerocopy_done)
+                    {
+                        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                        event.events = (uint32_t)EPOLLET | fd_ctx->events;
+                        if (epoll_ctl(m_epfd, op, fd_ctx->fd, &event))
+                        {
+                            std::cerr << "idle::epoll_ctl failed: " << strerror(errno) << std::endl;
+                        }
+                    }
                     continue;
                 }
 
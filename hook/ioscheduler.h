@@ -4,6 +4,8 @@
 #include "scheduler.h"
 #include "timer.h"
 
+#include <map>
+
 namespace sylar
 {
 
@@ -18,7 +20,9 @@ namespace sylar
             // READ == EPOLLIN
             READ = 0x1,
             // WRITE == EPOLLOUT
-            WRITE = 0x4
+            WRITE = 0x4,
+            // ZEROCOPY == EPOLLERR, MSG_ZEROCOPY completions on the error queue
+            ZEROCOPY = 0x8
         };
 
     private:
@@ -32,12 +36,32 @@ namespace sylar
                 std::shared_ptr<Fiber> fiber;
                 // callback function
                 std::function<void()> cb;
+                // tag of the wait that registered it, see delEvent()
+                const void *owner = nullptr;
+            };
+
+            struct ZeroCopyContext
+            {
+                // sends numbered below this have been released by the kernel
+                // the kernel's 32-bit numbers wrap -> kept widened to 64 bits, see widen()
+                uint64_t completed = 0;
+                // completion ranges [lo, hi] reported out of order above completed
+                std::map<uint64_t, uint64_t> ranges;
+                // waiters keyed by the sequence number of their send
+                std::multimap<uint64_t, EventContext> waiters;
+
+                // the 64-bit number of the kernel's seq, taken as the one nearest to completed
+                uint64_t widen(uint32_t seq) const { return completed + (int32_t)(seq - (uint32_t)completed); }
             };
 
             // read event context
             EventContext read;
             // write event context
             EventContext write;
+            // zero-copy completion context
+            ZeroCopyContext zerocopy;
+            // SO_BUSY_POLL already applied to the socket on this fd
+            bool busyPoll = false;
             int fd = 0;
             // events registered
             Event events = NONE;
@@ -46,21 +70,33 @@ namespace sylar
             EventContext &getEventContext(Event event);
             void resetEventContext(EventContext &ctx);
             void triggerEvent(Event event);
+
+            // read the error queue and advance zerocopy.completed
+            void drainZeroCopy();
+            // trigger the waiters whose sends have completed, return how many
+            size_t triggerZeroCopy(bool all = false);
         };
 
     public:
-        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+        // the worker threads start right away -> the idle policy and the worker cpus (see Scheduler::setWorkerCpus()) are given here
+        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager", const IdlePolicy &policy = IdlePolicy(),
+                  const std::vector<std::vector<int>> &cpus = {});
         ~IOManager();
 
-        // add one event at a time
-        int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
-        // delete event
-        bool delEvent(int fd, Event event);
+        // add one event at a time, owner tags the registration for delEvent()
+        int addEvent(int fd, Event event, std::function<void()> cb = nullptr, const void *owner = nullptr);
+        // delete event, owner != nullptr -> only if the registration is still the one added with that owner
+        // (it may have fired and been registered again by another fiber)
+        bool delEvent(int fd, Event event, const void *owner = nullptr);
         // delete the event and trigger its callback
         bool cancelEvent(int fd, Event event);
         // delete all events and trigger its callback
         bool cancelAll(int fd);
 
+        // wait until the kernel releases the pages of MSG_ZEROCOPY send number seq
+        // return 1 if already released (cb is scheduled at once), 0 if registered, -1 on error (errno from epoll_ctl)
+        int addZeroCopyEvent(int fd, uint32_t seq, std::function<void()> cb = nullptr);
+
         static IOManager *GetThis();
 
     protected:
@@ -0,0 +1,158 @@
+#include "fd_manager.h"
+#include "ioscheduler.h"
+#include "tcp_server.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace sylar;
+
+// 往返延迟测试：主线程通过socketpair发送1字节，IOManager中的协程回显
+// 对比默认的阻塞idle()和忙轮询模式，单核机器上忙轮询没有优势
+// 连接建立/关闭测试：客户端协程反复连接回环上的TcpServer，每个连接交换1字节后关闭
+// 两端的socket()/accept()都在FdMgr中注册，对比注册时用fstat/fcntl探测fd(旧路径)和不探测
+// ./a.out [rounds] -> 连接数为rounds / 10
+
+void echo(int fd)
+{
+    char c;
+    while (read(fd, &c, 1) == 1)
+    {
+        write(fd, &c, 1);
+    }
+    close(fd);
+}
+
+void bench(const char *name, const IdlePolicy &policy, int rounds)
+{
+    // 回显端非阻塞并注册到FdMgr -> read()挂起协程而不是阻塞工作线程
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    FdMgr::GetInstance()->addSocket(sv[1]);
+
+    IOManager manager(2, false, name, policy);
+    manager.scheduleLock(std::bind(&echo, sv[1]));
+
+    uint64_t total = 0, worst = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        char c = 'x';
+        auto start = std::chrono::steady_clock::now();
+        write(sv[0], &c, 1);
+        read(sv[0], &c, 1);
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        total += ns;
+        worst = std::max(worst, ns);
+        // 模拟请求之间的间隔
+        usleep(50);
+    }
+
+    // 回显协程读到EOF后退出
+    shutdown(sv[0], SHUT_WR);
+    manager.stop();
+    close(sv[0]);
+
+    std::cout << name << ": avg " << total / rounds << " ns, max " << worst << " ns" << std::endl;
+    for (int id : manager.getThreadIds())
+    {
+        IdleStats stats = manager.getIdleStats(id);
+        std::cout << "  thread " << id << ": poll " << stats.pollNs / 1000 << " us/" << stats.pollWakeups
+                  << ", block " << stats.blockNs / 1000 << " us/" << stats.blockWakeups << std::endl;
+    }
+}
+
+// 每个连接回显1字节后关闭
+class ChurnServer : public TcpServer
+{
+public:
+    using TcpServer::TcpServer;
+    ~ChurnServer() { stop(); }
+
+protected:
+    void handleClient(int client) override
+    {
+        char c;
+        if (read(client, &c, 1) == 1)
+        {
+            write(client, &c, 1);
+        }
+        close(client);
+    }
+};
+
+// 每个连接经过socket()/accept()在FdMgr中注册、close()注销，测的是这条路径而不是数据传输
+// probe -> 注册时和FdCtx::init()一样调用fstat/fcntl
+void churn(int conns, bool probe)
+{
+    FdMgr::GetInstance()->setProbeSockets(probe);
+    IOManager manager(2, false, "churn");
+    ChurnServer server(&manager);
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ::bind(fd, (sockaddr *)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    close(fd);
+    if (!server.bind((sockaddr *)&addr, sizeof(addr)) || !server.start())
+    {
+        return;
+    }
+
+    // 客户端也是协程 -> socket()经过钩子注册
+    const int clients = 4;
+    std::atomic<int> failed = {0};
+    WaitGroup wg;
+    wg.add(clients);
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < clients; k++)
+    {
+        manager.scheduleLock([&, k]()
+                             {
+            for (int i = k; i < conns; i += clients)
+            {
+                int client = socket(AF_INET, SOCK_STREAM, 0);
+                char c = 'x';
+                if (connect(client, (sockaddr *)&addr, sizeof(addr)) || write(client, &c, 1) != 1 || read(client, &c, 1) != 1)
+                {
+                    ++failed;
+                }
+                close(client);
+            }
+            wg.done(); });
+    }
+    wg.wait();
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    server.stop();
+    manager.stop();
+    FdMgr::GetInstance()->setProbeSockets(false);
+    std::cout << "churn (" << (probe ? "fstat/fcntl" : "no probe") << "): " << conns << " connections in " << us / 1000 << " ms, "
+              << (us ? conns * 1000000ULL / us : 0) << " conn/s, failed " << failed << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+
+    IdlePolicy blocking;
+    bench("blocking", blocking, rounds);
+
+    IdlePolicy busy;
+    busy.busyPoll = true;
+    busy.socketBusyPollUs = 50;
+    bench("busy poll", busy, rounds);
+
+    churn(std::max(rounds / 10, 1), true);
+    churn(std::max(rounds / 10, 1), false);
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "hook.h"
+#include "ioscheduler.h"
+
+#include <cstdlib>
+#include <dlfcn.h>
+#include <iostream>
+
+// entry-point shim for running an unmodified blocking binary on an IOManager
+// build the hook layer (every .cpp here except main.cpp) as a preloadable library:
+//   g++ -std=c++17 -O2 -shared -fPIC -o libsylar_hook.so $(ls hook/*.cpp | grep -v main.cpp) -ldl -lpthread
+//   LD_PRELOAD=./libsylar_hook.so ./server
+// work flow
+// 1 __libc_start_main() is interposed -> 2 the real main() runs in a fiber on a worker thread of an IOManager
+// -> 3 its socket calls park that fiber instead of blocking the thread -> 4 main() returns -> IOManager stops -> exit
+// environment:
+//   SYLAR_PRELOAD_THREADS     worker threads, default 1
+//   SYLAR_PRELOAD_STACK_SIZE  stack of the main() fiber in bytes, default 8MB like a thread
+// threads started by the program itself are not scheduler threads -> their calls stay blocking
+
+namespace
+{
+
+    typedef int (*main_fun)(int argc, char **argv, char **envp);
+    typedef int (*libc_start_main_fun)(main_fun main, int argc, char **argv, void (*init)(void), void (*fini)(void),
+                                       void (*rtld_fini)(void), void *stack_end);
+
+    main_fun s_main = nullptr;
+
+    size_t env_size(const char *name, size_t def)
+    {
+        const char *value = getenv(name);
+        if (!value || !*value)
+        {
+            return def;
+        }
+        char *end = nullptr;
+        unsigned long long v = strtoull(value, &end, 10);
+        if (*end || v == 0)
+        {
+            std::cerr << "sylar preload: ignore " << name << "=" << value << std::endl;
+            return def;
+        }
+        return v;
+    }
+
+    int sylar_main(int argc, char **argv, char **envp)
+    {
+        size_t threads = env_size("SYLAR_PRELOAD_THREADS", 1);
+        size_t stack_size = env_size("SYLAR_PRELOAD_STACK_SIZE", 8 * 1024 * 1024);
+
+        int ret = 0;
+        sylar::Semaphore done;
+        {
+            // stop() doesn't wait for fibers parked outside epoll (e.g. getaddrinfo() on the blocking pool)
+            // -> main() runs on a worker and this thread waits for it to return
+            sylar::IOManager iom(threads, false, "preload");
+            iom.scheduleLock(std::make_shared<sylar::Fiber>([&]()
+                                                            {
+                ret = s_main(argc, argv, envp);
+                done.signal(); },
+                                                            stack_size));
+            done.wait();
+            iom.stop();
+        }
+        return ret;
+    }
+
+} // namespace
+
+extern "C"
+{
+    int __libc_start_main(main_fun main, int argc, char **argv, void (*init)(void), void (*fini)(void), void (*rtld_fini)(void),
+                          void *stack_end)
+    {
+        libc_start_main_fun real = (libc_start_main_fun)dlsym(RTLD_NEXT, "__libc_start_main");
+        if (!real)
+        {
+            std::cerr << "sylar preload: __libc_start_main not found: " << dlerror() << std::endl;
+            abort();
+        }
+        s_main = main;
+        return real(sylar_main, argc, argv, init, fini, rtld_fini, stack_end);
+    }
+}
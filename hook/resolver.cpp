@@ -0,0 +1,788 @@
+#include "resolver.h"
+
+#include <algorithm>
+#include <cctype>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <sys/time.h>
+
+namespace sylar
+{
+
+    static const uint16_t TYPE_A = 1;
+    static const uint16_t TYPE_SOA = 6;
+    static const uint16_t TYPE_AAAA = 28;
+
+    static const int RCODE_NOERROR = 0;
+    static const int RCODE_NXDOMAIN = 3;
+
+    // 缓存条目数上限，超出时先清理过期的
+    static const size_t MAX_CACHE = 4096;
+
+    static uint64_t NowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static std::string to_lower(std::string name)
+    {
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (!name.empty() && name.back() == '.')
+        {
+            name.pop_back();
+        }
+        return name;
+    }
+
+    // 数字地址 -> addr，端口为0
+    static bool parse_numeric(const std::string &host, sockaddr_storage &addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        sockaddr_in *v4 = (sockaddr_in *)&addr;
+        if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1)
+        {
+            v4->sin_family = AF_INET;
+            return true;
+        }
+        sockaddr_in6 *v6 = (sockaddr_in6 *)&addr;
+        if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1)
+        {
+            v6->sin6_family = AF_INET6;
+            return true;
+        }
+        return false;
+    }
+
+    // 没有配置nameserver时和glibc一样使用本机
+    static sockaddr_storage local_nameserver()
+    {
+        sockaddr_storage addr;
+        parse_numeric("127.0.0.1", addr);
+        ((sockaddr_in *)&addr)->sin_port = htons(53);
+        return addr;
+    }
+
+    static bool family_match(int family, const sockaddr_storage &addr)
+    {
+        return family == AF_UNSPEC || family == addr.ss_family;
+    }
+
+    static void put16(std::string &out, uint16_t v)
+    {
+        out.push_back((char)(v >> 8));
+        out.push_back((char)(v & 0xff));
+    }
+
+    static uint16_t get16(const uint8_t *p)
+    {
+        return (uint16_t)(p[0] << 8 | p[1]);
+    }
+
+    static uint32_t get32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+
+    // 查询报文：RD置位，一个问题
+    static bool build_query(uint16_t id, const std::string &name, uint16_t qtype, std::string &out)
+    {
+        out.clear();
+        put16(out, id);
+        put16(out, 0x0100);
+        put16(out, 1);
+        put16(out, 0);
+        put16(out, 0);
+        put16(out, 0);
+
+        size_t pos = 0;
+        while (pos < name.size())
+        {
+            size_t dot = name.find('.', pos);
+            if (dot == std::string::npos)
+            {
+                dot = name.size();
+            }
+            size_t len = dot - pos;
+            if (len == 0 || len > 63)
+            {
+                return false;
+            }
+            out.push_back((char)len);
+            out.append(name, pos, len);
+            pos = dot + 1;
+        }
+        out.push_back(0);
+        if (out.size() - 12 > 255)
+        {
+            return false;
+        }
+
+        put16(out, qtype);
+        // IN
+        put16(out, 1);
+        return true;
+    }
+
+    // 跳过报文中的一个名字(可能被压缩)，越界返回false
+    static bool skip_name(const uint8_t *buf, size_t len, size_t &pos)
+    {
+        while (pos < len)
+        {
+            uint8_t l = buf[pos];
+            if (l == 0)
+            {
+                ++pos;
+                return true;
+            }
+            // 压缩指针 -> 名字到此结束
+            if ((l & 0xc0) == 0xc0)
+            {
+                pos += 2;
+                return pos <= len;
+            }
+            pos += l + 1;
+        }
+        return false;
+    }
+
+    // 应答中的问题是否就是所查询的：名字(qname为查询报文中的编码)不区分大小写，类型相同，类为IN
+    // 长度字节不超过63，不受大小写转换影响 -> 整段逐字节比较
+    static bool match_question(const uint8_t *buf, size_t len, size_t &pos, const std::string &qname, uint16_t qtype)
+    {
+        if (pos + qname.size() + 4 > len)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < qname.size(); ++i)
+        {
+            if (tolower(buf[pos + i]) != tolower((uint8_t)qname[i]))
+            {
+                return false;
+            }
+        }
+        pos += qname.size();
+        if (get16(buf + pos) != qtype || get16(buf + pos + 2) != 1)
+        {
+            return false;
+        }
+        pos += 4;
+        return true;
+    }
+
+    // 解析应答：收集A/AAAA记录，ttl为这些记录(或否定应答中SOA)的最小TTL
+    // 16位的id之外还要求问题与查询一致 -> 拒绝伪造的应答和属于其他查询的过期应答
+    static bool parse_response(const uint8_t *buf, size_t len, const std::string &qname, uint16_t qtype, int &rcode,
+                               std::vector<sockaddr_storage> &addrs, uint32_t &ttl)
+    {
+        if (len < 12 || !(buf[2] & 0x80))
+        {
+            return false;
+        }
+        rcode = buf[3] & 0x0f;
+        uint16_t qdcount = get16(buf + 4);
+        uint16_t ancount = get16(buf + 6);
+        uint16_t nscount = get16(buf + 8);
+
+        size_t pos = 12;
+        if (qdcount != 1 || !match_question(buf, len, pos, qname, qtype))
+        {
+            return false;
+        }
+
+        ttl = UINT32_MAX;
+        bool has_ttl = false;
+        for (uint32_t i = 0; i < (uint32_t)ancount + nscount; ++i)
+        {
+            if (!skip_name(buf, len, pos) || pos + 10 > len)
+            {
+                return false;
+            }
+            uint16_t type = get16(buf + pos);
+            uint32_t rttl = get32(buf + pos + 4);
+            uint16_t rdlen = get16(buf + pos + 8);
+            pos += 10;
+            if (pos + rdlen > len)
+            {
+                return false;
+            }
+            const uint8_t *rdata = buf + pos;
+            pos += rdlen;
+
+            bool answer = i < ancount;
+            if (answer && type == qtype && type == TYPE_A && rdlen == 4)
+            {
+                sockaddr_storage addr = {};
+                sockaddr_in *v4 = (sockaddr_in *)&addr;
+                v4->sin_family = AF_INET;
+                memcpy(&v4->sin_addr, rdata, 4);
+                addrs.push_back(addr);
+            }
+            else if (answer && type == qtype && type == TYPE_AAAA && rdlen == 16)
+            {
+                sockaddr_storage addr = {};
+                sockaddr_in6 *v6 = (sockaddr_in6 *)&addr;
+                v6->sin6_family = AF_INET6;
+                memcpy(&v6->sin6_addr, rdata, 16);
+                addrs.push_back(addr);
+            }
+            else if (!answer && type == TYPE_SOA && rdlen >= 20)
+            {
+                // 否定应答的缓存时间：SOA记录的TTL和其MINIMUM字段中较小的一个
+                rttl = std::min(rttl, get32(rdata + rdlen - 4));
+            }
+            else
+            {
+                continue;
+            }
+            ttl = std::min(ttl, rttl);
+            has_ttl = true;
+        }
+        if (!has_ttl)
+        {
+            ttl = 0;
+        }
+        return true;
+    }
+
+    Resolver *Resolver::GetInstance()
+    {
+        static Resolver *resolver = new Resolver();
+        return resolver;
+    }
+
+    bool Resolver::loadResolvConf(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            return false;
+        }
+
+        std::vector<sockaddr_storage> servers;
+        std::vector<std::string> search;
+        uint64_t timeout = 5000;
+        int attempts = 2;
+        int ndots = 1;
+
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream ss(line);
+            std::string key;
+            ss >> key;
+            if (key == "nameserver")
+            {
+                std::string ip;
+                ss >> ip;
+                // fe80::1%eth0 -> 不支持scope，忽略
+                sockaddr_storage addr;
+                if (servers.size() < 3 && parse_numeric(ip, addr))
+                {
+                    ((sockaddr_in *)&addr)->sin_port = htons(53);
+                    servers.push_back(addr);
+                }
+            }
+            else if (key == "search" || key == "domain")
+            {
+                // 和glibc一样，最后一行search/domain有效
+                search.clear();
+                std::string domain;
+                while (ss >> domain)
+                {
+                    search.push_back(domain);
+                }
+            }
+            else if (key == "options")
+            {
+                std::string opt;
+                while (ss >> opt)
+                {
+                    if (opt.compare(0, 6, "ndots:") == 0)
+                    {
+                        ndots = std::min(15, std::max(0, atoi(opt.c_str() + 6)));
+                    }
+                    else if (opt.compare(0, 8, "timeout:") == 0)
+                    {
+                        timeout = std::max(1, atoi(opt.c_str() + 8)) * 1000ull;
+                    }
+                    else if (opt.compare(0, 9, "attempts:") == 0)
+                    {
+                        attempts = std::max(1, atoi(opt.c_str() + 9));
+                    }
+                }
+            }
+        }
+
+        if (servers.empty())
+        {
+            servers.push_back(local_nameserver());
+        }
+
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_servers = servers;
+        m_search = search;
+        m_timeout = timeout;
+        m_attempts = attempts;
+        m_ndots = ndots;
+        m_confLoaded = true;
+        return true;
+    }
+
+    bool Resolver::loadNsswitch(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            return false;
+        }
+
+        // 没有hosts行 -> glibc默认为dns files
+        bool dns_only = true;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream ss(line);
+            std::string key, source;
+            if (!(ss >> key) || key != "hosts:")
+            {
+                continue;
+            }
+            dns_only = true;
+            while (ss >> source)
+            {
+                // [NOTFOUND=return]之类的动作不是来源
+                if (source[0] != '[' && source != "files" && source != "dns")
+                {
+                    dns_only = false;
+                }
+            }
+        }
+
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dnsOnly = dns_only;
+        m_nssLoaded = true;
+        return true;
+    }
+
+    bool Resolver::canResolve(const std::string &host)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        loadDefaults();
+        if (!m_dnsOnly)
+        {
+            return false;
+        }
+        // 以点结尾 -> 完整的名字，不加search域
+        if (host.empty() || host.back() == '.' || m_search.empty())
+        {
+            return true;
+        }
+        // 点少于ndots -> glibc先尝试加上search域
+        return std::count(host.begin(), host.end(), '.') >= m_ndots;
+    }
+
+    bool Resolver::loadHosts(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            return false;
+        }
+
+        std::map<std::string, std::vector<sockaddr_storage>> hosts;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream ss(line);
+            std::string ip, name;
+            sockaddr_storage addr;
+            if (!(ss >> ip) || !parse_numeric(ip, addr))
+            {
+                continue;
+            }
+            while (ss >> name)
+            {
+                hosts[to_lower(name)].push_back(addr);
+            }
+        }
+
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_hosts.swap(hosts);
+        m_hostsLoaded = true;
+        return true;
+    }
+
+    void Resolver::setNameservers(const std::vector<sockaddr_storage> &servers)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        loadDefaults();
+        m_servers = servers;
+    }
+
+    void Resolver::setTimeout(uint64_t timeout_ms, int attempts)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        loadDefaults();
+        m_timeout = timeout_ms;
+        m_attempts = std::max(1, attempts);
+    }
+
+    void Resolver::clearCache()
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cache.clear();
+    }
+
+    // no lock
+    void Resolver::loadDefaults()
+    {
+        // 调用者已经指定的不再读取系统文件
+        bool hosts = !m_hostsLoaded;
+        bool conf = !m_confLoaded;
+        bool nss = !m_nssLoaded;
+        if (!hosts && !conf && !nss)
+        {
+            return;
+        }
+        m_hostsLoaded = true;
+        m_confLoaded = true;
+        m_nssLoaded = true;
+
+        // 读取文件时不持有锁
+        m_mutex.unlock();
+        if (hosts)
+        {
+            loadHosts();
+        }
+        if (nss)
+        {
+            loadNsswitch();
+        }
+        bool ok = !conf || loadResolvConf();
+        m_mutex.lock();
+
+        if (!ok && m_servers.empty())
+        {
+            m_servers.push_back(local_nameserver());
+        }
+    }
+
+    int Resolver::resolve(const std::string &host, int family, std::vector<sockaddr_storage> &addrs)
+    {
+        addrs.clear();
+        if (family != AF_UNSPEC && family != AF_INET && family != AF_INET6)
+        {
+            return EAI_FAMILY;
+        }
+
+        // 1 数字地址
+        sockaddr_storage numeric;
+        if (parse_numeric(host, numeric))
+        {
+            if (!family_match(family, numeric))
+            {
+                return EAI_NONAME;
+            }
+            addrs.push_back(numeric);
+            return 0;
+        }
+
+        std::string name = to_lower(host);
+        if (name.empty())
+        {
+            return EAI_NONAME;
+        }
+
+        std::vector<uint16_t> qtypes;
+        if (family != AF_INET6)
+        {
+            qtypes.push_back(TYPE_A);
+        }
+        if (family != AF_INET)
+        {
+            qtypes.push_back(TYPE_AAAA);
+        }
+
+        RuntimeScope scope;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        loadDefaults();
+
+        // 1 /etc/hosts
+        auto hit = m_hosts.find(name);
+        if (hit != m_hosts.end())
+        {
+            for (const sockaddr_storage &addr : hit->second)
+            {
+                if (family_match(family, addr))
+                {
+                    addrs.push_back(addr);
+                }
+            }
+            if (!addrs.empty())
+            {
+                return 0;
+            }
+        }
+
+        // 2 缓存
+        uint64_t now = NowMs();
+        bool cached = true;
+        int error = EAI_NONAME;
+        for (uint16_t qtype : qtypes)
+        {
+            auto it = m_cache.find({name, qtype});
+            if (it == m_cache.end() || it->second.expire <= now)
+            {
+                cached = false;
+                break;
+            }
+            addrs.insert(addrs.end(), it->second.addrs.begin(), it->second.addrs.end());
+        }
+        if (cached)
+        {
+            return addrs.empty() ? error : 0;
+        }
+        addrs.clear();
+
+        // 3 同名查询正在进行 -> 等待它的结果
+        std::pair<std::string, int> key(name, family);
+        auto pit = m_pending.find(key);
+        if (pit != m_pending.end())
+        {
+            std::shared_ptr<Pending> pending = pit->second;
+            FiberWaiter waiter;
+            pending->waiters.push_back(&waiter);
+            waiter.wait(lock);
+
+            addrs = pending->addrs;
+            return pending->error;
+        }
+
+        std::shared_ptr<Pending> pending = std::make_shared<Pending>();
+        m_pending[key] = pending;
+        lock.unlock();
+
+        // 4 查询，不持有锁
+        std::map<uint16_t, Answer> answers;
+        query(name, qtypes, answers);
+
+        // 有一种类型成功即成功；都失败时优先报告暂时性的错误
+        bool ok = false;
+        bool again = false;
+        for (uint16_t qtype : qtypes)
+        {
+            const Answer &answer = answers[qtype];
+            addrs.insert(addrs.end(), answer.addrs.begin(), answer.addrs.end());
+            ok = ok || answer.error == 0;
+            again = again || answer.error == EAI_AGAIN;
+        }
+        if (!addrs.empty())
+        {
+            error = 0;
+        }
+        else if (again)
+        {
+            error = EAI_AGAIN;
+        }
+        else if (ok)
+        {
+            // 名字存在但没有该类型的地址
+            error = EAI_NONAME;
+        }
+        else
+        {
+            error = answers[qtypes[0]].error;
+        }
+
+        std::deque<FiberWaiter *> waiters;
+        lock.lock();
+        now = NowMs();
+        if (m_cache.size() >= MAX_CACHE)
+        {
+            for (auto it = m_cache.begin(); it != m_cache.end();)
+            {
+                it = it->second.expire <= now ? m_cache.erase(it) : std::next(it);
+            }
+            if (m_cache.size() >= MAX_CACHE)
+            {
+                m_cache.clear();
+            }
+        }
+        for (auto &i : answers)
+        {
+            if (i.second.expire > now)
+            {
+                m_cache[{name, i.first}] = i.second;
+            }
+        }
+
+        pending->error = error;
+        pending->addrs = addrs;
+        waiters.swap(pending->waiters);
+        m_pending.erase(key);
+        lock.unlock();
+
+        for (FiberWaiter *waiter : waiters)
+        {
+            waiter->wake();
+        }
+        return error;
+    }
+
+    void Resolver::query(const std::string &name, const std::vector<uint16_t> &qtypes, std::map<uint16_t, Answer> &answers)
+    {
+        std::vector<sockaddr_storage> servers;
+        int attempts = 0;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            servers = m_servers;
+            attempts = m_attempts;
+        }
+
+        for (int i = 0; i < attempts; ++i)
+        {
+            for (const sockaddr_storage &server : servers)
+            {
+                // 得到确定的应答(存在/不存在) -> 结束
+                if (queryServer(server, name, qtypes, answers))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    bool Resolver::queryServer(const sockaddr_storage &server, const std::string &name, const std::vector<uint16_t> &qtypes,
+                               std::map<uint16_t, Answer> &answers)
+    {
+        static thread_local std::mt19937 rng(std::random_device{}());
+
+        uint64_t timeout = 0;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            timeout = m_timeout;
+        }
+
+        socklen_t addrlen = server.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+        // 钩子的socket -> 在协程中收发时只挂起协程
+        int fd = socket(server.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            return false;
+        }
+        // connect -> 只接收来自该服务器的应答
+        if (connect(fd, (const sockaddr *)&server, addrlen))
+        {
+            close(fd);
+            return false;
+        }
+
+        // 各类型的查询同时发出
+        std::map<uint16_t, uint16_t> ids;
+        // 查询报文中编码后的名字，用来核对应答中的问题
+        std::string qname;
+        for (uint16_t qtype : qtypes)
+        {
+            if (answers.count(qtype) && answers[qtype].error != EAI_AGAIN)
+            {
+                continue;
+            }
+            std::string packet;
+            if (!build_query((uint16_t)rng(), name, qtype, packet))
+            {
+                answers[qtype].error = EAI_NONAME;
+                continue;
+            }
+            ids[get16((const uint8_t *)packet.data())] = qtype;
+            qname = packet.substr(12, packet.size() - 12 - 4);
+            send(fd, packet.data(), packet.size(), 0);
+        }
+
+        // 所有应答共用一个截止时间 -> 无关的报文不会延长等待
+        uint64_t deadline = NowMs() + timeout;
+        uint8_t buf[4096];
+        while (!ids.empty())
+        {
+            uint64_t now = NowMs();
+            if (now >= deadline)
+            {
+                break;
+            }
+            uint64_t left = deadline - now;
+            timeval tv = {(time_t)(left / 1000), (suseconds_t)(left % 1000 * 1000)};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n < 0)
+            {
+                // 超时/出错 -> 剩下的类型换下一个服务器
+                break;
+            }
+            if (n < 12)
+            {
+                continue;
+            }
+
+            auto it = ids.find(get16(buf));
+            if (it == ids.end())
+            {
+                continue;
+            }
+            uint16_t qtype = it->second;
+
+            int rcode = 0;
+            uint32_t ttl = 0;
+            std::vector<sockaddr_storage> addrs;
+            if (!parse_response(buf, n, qname, qtype, rcode, addrs, ttl))
+            {
+                continue;
+            }
+            ids.erase(it);
+
+            // 截断的应答只使用其中完整的地址，不改用TCP
+            Answer &answer = answers[qtype];
+            answer.addrs = addrs;
+            answer.expire = ttl ? NowMs() + ttl * 1000ull : 0;
+            if (rcode == RCODE_NOERROR)
+            {
+                answer.error = 0;
+            }
+            else if (rcode == RCODE_NXDOMAIN)
+            {
+                answer.error = EAI_NONAME;
+            }
+            else
+            {
+                // SERVFAIL/REFUSED -> 换下一个服务器
+                answer.error = EAI_AGAIN;
+                answer.expire = 0;
+            }
+        }
+        close(fd);
+
+        for (uint16_t qtype : qtypes)
+        {
+            if (!answers.count(qtype) || answers[qtype].error == EAI_AGAIN)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
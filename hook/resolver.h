@@ -0,0 +1,93 @@
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+
+#include "fiber_sync.h"
+
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+namespace sylar
+{
+
+    // 协程DNS解析：通过钩子的UDP套接字向/etc/resolv.conf中的服务器查询，解析期间只挂起当前协程
+    // work flow
+    // 1 数字地址/etc/hosts -> 2 缓存(遵守TTL) -> 3 同名的查询正在进行则等待它的结果 -> 4 依次向各服务器查询A/AAAA
+    class Resolver
+    {
+    public:
+        static Resolver *GetInstance();
+
+        // family: AF_INET / AF_INET6 / AF_UNSPEC(两者)，地址的端口为0
+        // 返回0成功，否则返回EAI_NONAME(不存在)、EAI_AGAIN(超时/服务器暂时失败)、EAI_FAIL(其他错误)
+        int resolve(const std::string &host, int family, std::vector<sockaddr_storage> &addrs);
+
+        // 能否给出与系统getaddrinfo()相同的结果：有search域且名字中的点少于ndots、或者NSS的hosts用到files/dns以外的来源时返回false
+        // 返回false，或者resolve()的失败可能由search域等挽回 -> 调用者改用系统的getaddrinfo()
+        bool canResolve(const std::string &host);
+
+        // 以下用于替换系统配置，例如在测试中指向本地的DNS服务器；第一次resolve()之前没有调用时读取系统文件
+        bool loadResolvConf(const std::string &path = "/etc/resolv.conf");
+        bool loadHosts(const std::string &path = "/etc/hosts");
+        bool loadNsswitch(const std::string &path = "/etc/nsswitch.conf");
+        void setNameservers(const std::vector<sockaddr_storage> &servers);
+        // 每个服务器一次查询(包括它的所有应答)的超时时间，以及轮询所有服务器的次数
+        void setTimeout(uint64_t timeout_ms, int attempts);
+        void clearCache();
+
+    private:
+        Resolver() = default;
+
+        // 一种记录类型(A/AAAA)的查询结果
+        struct Answer
+        {
+            // 0 / EAI_NONAME / EAI_AGAIN / EAI_FAIL
+            int error = EAI_AGAIN;
+            std::vector<sockaddr_storage> addrs;
+            // 过期时间(毫秒)，0 -> 不缓存
+            uint64_t expire = 0;
+        };
+
+        // 正在进行的查询，同名的请求等待它完成
+        struct Pending
+        {
+            int error = 0;
+            std::vector<sockaddr_storage> addrs;
+            std::deque<FiberWaiter *> waiters;
+        };
+
+        // no lock
+        void loadDefaults();
+        // 不加锁 -> 查询期间不持有m_mutex
+        void query(const std::string &name, const std::vector<uint16_t> &qtypes, std::map<uint16_t, Answer> &answers);
+        bool queryServer(const sockaddr_storage &server, const std::string &name, const std::vector<uint16_t> &qtypes,
+                         std::map<uint16_t, Answer> &answers);
+
+    private:
+        std::mutex m_mutex;
+        // 是否已经读取(或由调用者指定) hosts / resolv.conf / nsswitch.conf
+        bool m_hostsLoaded = false;
+        bool m_confLoaded = false;
+        bool m_nssLoaded = false;
+        std::vector<sockaddr_storage> m_servers;
+        // resolv.conf的search(或domain)和ndots
+        std::vector<std::string> m_search;
+        int m_ndots = 1;
+        // nsswitch.conf的hosts只有files和dns
+        bool m_dnsOnly = true;
+        uint64_t m_timeout = 5000;
+        int m_attempts = 2;
+        // 小写的主机名 -> 地址
+        std::map<std::string, std::vector<sockaddr_storage>> m_hosts;
+        // (主机名, 记录类型) -> 结果
+        std::map<std::pair<std::string, uint16_t>, Answer> m_cache;
+        // (主机名, family) -> 正在进行的查询
+        std::map<std::pair<std::string, int>, std::shared_ptr<Pending>> m_pending;
+    };
+
+}
+
+#endif
@@ -1,17 +1,52 @@
 #include "scheduler.h"
 
+#include <chrono>
+#include <thread>
+
 static bool debug = false;
 
 namespace sylar
 {
 
+    // 每个工作线程的空闲统计
+    struct IdleCounters
+    {
+        std::atomic<uint64_t> spinNs = {0};
+        std::atomic<uint64_t> pollNs = {0};
+        std::atomic<uint64_t> blockNs = {0};
+        std::atomic<uint64_t> spinWakeups = {0};
+        std::atomic<uint64_t> pollWakeups = {0};
+        std::atomic<uint64_t> blockWakeups = {0};
+
+        // 以下只由所属线程访问
+        // 最近的任务到达间隔(纳秒)，指数平均
+        uint64_t avgGapNs = 0;
+        // 本次空闲开始/阻塞开始的时间
+        uint64_t idleStart = 0;
+        uint64_t blockStart = 0;
+    };
+
     static thread_local Scheduler *t_scheduler = nullptr;
+    static thread_local Fiber *t_runningTask = nullptr;
+    static thread_local IdleCounters *t_idleCounters = nullptr;
+    // 弹性线程的空闲退出时间，0 -> 不是弹性线程
+    static thread_local uint64_t t_retireAfterMs = 0;
+
+    static uint64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
     Scheduler *Scheduler::GetThis()
     {
         return t_scheduler;
     }
 
+    Fiber *Scheduler::GetRunningTask()
+    {
+        return t_runningTask;
+    }
+
     void Scheduler::SetThis()
     {
         t_scheduler = this;
@@ -70,13 +105,147 @@ namespace sylar
         m_threads.resize(m_threadCount);
         for (size_t i = 0; i < m_threadCount; i++)
         {
-            m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+            m_threads[i] = newWorker(i, 0);
             m_threadIds.push_back(m_threads[i]->getId());
         }
+
+        m_started = true;
+        if (m_elastic.maxThreads && !m_monitor)
+        {
+            m_monitor.reset(new Thread(std::bind(&Scheduler::monitor, this), m_name + "_monitor"));
+        }
         if (debug)
             std::cout << "Scheduler::start() success\n";
     }
 
+    uint64_t Scheduler::NowMs()
+    {
+        return NowNs() / 1000000;
+    }
+
+    std::shared_ptr<Thread> Scheduler::newWorker(size_t index, uint64_t retire_ms)
+    {
+        std::vector<int> cpus;
+        if (!m_workerCpus.empty())
+        {
+            cpus = m_workerCpus[index % m_workerCpus.size()];
+        }
+
+        auto cb = [this, cpus, retire_ms]()
+        {
+            // 在线程内绑定，之后才运行调度循环
+            if (!cpus.empty())
+            {
+                Thread::SetAffinity(cpus);
+            }
+            t_retireAfterMs = retire_ms;
+            run();
+        };
+        return std::make_shared<Thread>(cb, m_name + "_" + std::to_string(index));
+    }
+
+    void Scheduler::setElasticPolicy(const ElasticPolicy &policy)
+    {
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_elastic = policy;
+        if (m_started && !m_stopping && m_elastic.maxThreads && !m_monitor)
+        {
+            m_monitor.reset(new Thread(std::bind(&Scheduler::monitor, this), m_name + "_monitor"));
+        }
+    }
+
+    void Scheduler::monitor()
+    {
+        while (true)
+        {
+            uint64_t tick = 1;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                tick = std::max<uint64_t>(1, m_elastic.growAfterMs / 2);
+            }
+            m_monitorEvent.wait(tick);
+
+            std::vector<std::shared_ptr<Thread>> retired;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stopping)
+                {
+                    break;
+                }
+                retired.swap(m_retiredThreads);
+
+                size_t workers = m_threadCount + (m_useCaller ? 1 : 0) + m_elasticThreads.size();
+                if (workers < m_elastic.maxThreads)
+                {
+                    // 最早入队的任务，指定了线程的任务新增线程也帮不上
+                    uint64_t now = NowMs();
+                    for (const ScheduleTask &task : m_tasks)
+                    {
+                        if (task.thread != -1 || task.enqueued == 0)
+                        {
+                            continue;
+                        }
+                        if (now - task.enqueued >= m_elastic.growAfterMs)
+                        {
+                            if (debug)
+                                std::cout << "Scheduler::monitor() grows, queued " << now - task.enqueued << "ms" << std::endl;
+                            // 持有锁创建 -> 新线程的run()等到插入完成之后才开始
+                            std::shared_ptr<Thread> thread = newWorker(m_threadCount + m_elasticSeq++, m_elastic.retireAfterMs);
+                            m_elasticThreads[thread->getId()] = thread;
+                            // 线程id被新线程复用
+                            m_retiredIds.erase(thread->getId());
+                        }
+                        break;
+                    }
+                }
+            }
+
+            for (auto &thread : retired)
+            {
+                thread->join();
+            }
+        }
+    }
+
+    uint64_t Scheduler::retireAfterMs() const
+    {
+        return t_retireAfterMs;
+    }
+
+    bool Scheduler::tryRetire()
+    {
+        int thread_id = Thread::GetThreadId();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping)
+        {
+            return false;
+        }
+
+        // 还有指定给本线程的任务
+        for (const ScheduleTask &task : m_tasks)
+        {
+            if (task.thread == thread_id)
+            {
+                return false;
+            }
+        }
+
+        auto it = m_elasticThreads.find(thread_id);
+        if (it == m_elasticThreads.end())
+        {
+            return false;
+        }
+        // 由监控线程或者stop()来join
+        m_retiredThreads.push_back(it->second);
+        m_elasticThreads.erase(it);
+        m_retiredIds.insert(thread_id);
+        // 之后本线程不再记录空闲统计
+        m_idleCounters.erase(thread_id);
+        t_idleCounters = nullptr;
+        return true;
+    }
+
     void Scheduler::run()
     {
         int thread_id = Thread::GetThreadId();
@@ -93,6 +262,16 @@ namespace sylar
             Fiber::GetThis();
         }
 
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::unique_ptr<IdleCounters> &counters = m_idleCounters[thread_id];
+            if (!counters)
+            {
+                counters.reset(new IdleCounters);
+            }
+            t_idleCounters = counters.get();
+        }
+
         std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
         ScheduleTask task;
 
@@ -101,30 +280,44 @@ namespace sylar
             task.reset();
             bool tickle_me = false;
 
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_tasks.begin();
-            // 1 遍历任务队列
-            while (it != m_tasks.end())
             {
-                if (it->thread != -1 && it->thread != thread_id)
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_tasks.begin();
+                // 1 遍历任务队列
+                while (it != m_tasks.end())
                 {
-                    it++;
-                    tickle_me = true;
-                    continue;
-                }
+                    if (it->thread != -1 && it->thread != thread_id)
+                    {
+                        it++;
+                        tickle_me = true;
+                        continue;
+                    }
 
-                // 2 取出任务
-                assert(it->fiber || it->cb);
-                task = *it;
-                m_tasks.erase(it);
-                m_activeThreadCount++;
-                break;
+                    // 2 取出任务
+                    assert(it->fiber || it->cb);
+                    task = *it;
+                    it = m_tasks.erase(it);
+                    m_taskCount = m_tasks.size();
+                    m_activeThreadCount++;
+                    break;
+                }
+                tickle_me = tickle_me || (it != m_tasks.end());
+                // 没有任务 -> 在锁内计为空闲：scheduleLock()在锁内检查空闲线程数，之后入队的任务一定会tickle()
+                // 否则在这里和进入idle之间入队的任务(尤其是指定给本线程的)会错过唤醒
+                if (!task.fiber && !task.cb)
+                {
+                    m_idleThreadCount++;
+                }
             }
-            tickle_me = tickle_me || (it != m_tasks.end());
 
             if (tickle_me)
             {
                 tickle();
+                // 只有指定给其他线程的任务 -> 先让出CPU，否则本线程进入idle后可能自己取走这次唤醒，目标线程继续休眠
+                if (!task.fiber && !task.cb)
+                {
+                    std::this_thread::yield();
+                }
             }
 
             // 3 执行任务
@@ -134,7 +327,9 @@ namespace sylar
                     std::lock_guard<std::mutex> lock(task.fiber->m_mutex);
                     if (task.fiber->getState() != Fiber::TERM)
                     {
+                        t_runningTask = task.fiber.get();
                         task.fiber->resume();
+                        t_runningTask = nullptr;
                     }
                 }
                 m_activeThreadCount--;
@@ -143,9 +338,12 @@ namespace sylar
             else if (task.cb)
             {
                 std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);
-
-                std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
-                cb_fiber->resume();
+                {
+                    std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
+                    t_runningTask = cb_fiber.get();
+                    cb_fiber->resume();
+                    t_runningTask = nullptr;
+                }
 
                 m_activeThreadCount--;
                 task.reset();
@@ -161,9 +359,9 @@ namespace sylar
                         std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
                     }
 
+                    m_idleThreadCount--;
                     break;
                 }
-                m_idleThreadCount++;
                 idle_fiber->resume();
                 m_idleThreadCount--;
             }
@@ -216,6 +414,28 @@ namespace sylar
             thrs.swap(m_threads);
         }
 
+        // 弹性线程也随关闭流程退出
+        std::shared_ptr<Thread> monitor;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            monitor.swap(m_monitor);
+        }
+        if (monitor)
+        {
+            m_monitorEvent.set();
+            monitor->join();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &i : m_elasticThreads)
+            {
+                thrs.push_back(i.second);
+            }
+            m_elasticThreads.clear();
+            thrs.insert(thrs.end(), m_retiredThreads.begin(), m_retiredThreads.end());
+            m_retiredThreads.clear();
+        }
+
         for (auto &i : thrs)
         {
             i->join();
@@ -226,6 +446,8 @@ namespace sylar
 
     void Scheduler::tickle()
     {
+        // 唤醒一个休眠的工作线程，没有线程休眠时保留到下一次idle()
+        m_idleEvent.set();
     }
 
     void Scheduler::idle()
@@ -237,13 +459,189 @@ namespace sylar
                 std::cout << "Scheduler::idle(), sleeping in thread: " << Thread::GetThreadId() << std::endl;
             }
 
-            sleep(1);
+            if (m_idlePolicy.busyPoll)
+            {
+                idleBusyPoll();
+            }
+            // 阻塞直到tickle()，弹性线程空闲太久 -> 退出
+            else if (!idleSpin())
+            {
+                uint64_t retire_ms = t_retireAfterMs;
+                bool woken = m_idleEvent.wait(retire_ms ? (int64_t)retire_ms : -1);
+                idleBlocked();
+                if (!woken && retire_ms && tryRetire())
+                {
+                    break;
+                }
+            }
             Fiber::GetThis()->yield();
         }
+
+        // 每次只唤醒一个线程 -> 退出前把唤醒传给下一个休眠的线程
+        tickle();
+    }
+
+    IdleStats Scheduler::getIdleStats(int thread)
+    {
+        IdleStats stats;
+        RuntimeScope scope;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_idleCounters.find(thread);
+        if (it != m_idleCounters.end())
+        {
+            const IdleCounters &c = *it->second;
+            stats.spinNs = c.spinNs;
+            stats.pollNs = c.pollNs;
+            stats.blockNs = c.blockNs;
+            stats.spinWakeups = c.spinWakeups;
+            stats.pollWakeups = c.pollWakeups;
+            stats.blockWakeups = c.blockWakeups;
+        }
+        return stats;
+    }
+
+    bool Scheduler::idleSpin(const std::function<bool()> &poll)
+    {
+        IdleCounters *c = t_idleCounters;
+        uint64_t start = NowNs();
+        c->idleStart = start;
+        c->blockStart = start;
+
+        // 自旋时间：任务到达间隔远大于spinUs -> 自旋只是浪费，直接阻塞
+        // 单核 -> 自旋时任务的生产者无法运行
+        static const bool single_core = std::thread::hardware_concurrency() <= 1;
+        uint64_t max_spin = single_core ? 0 : m_idlePolicy.spinUs * 1000ull;
+        uint64_t spin = max_spin;
+        if (m_idlePolicy.adaptive)
+        {
+            spin = c->avgGapNs > max_spin ? 0 : std::min(max_spin, c->avgGapNs * 2);
+        }
+        uint32_t polls = poll ? m_idlePolicy.pollCount : 0;
+        if (spin == 0 && polls == 0)
+        {
+            return false;
+        }
+
+        // 自旋/轮询期间scheduleLock()不会tickle() -> 需要自己发现新任务
+        m_spinningThreadCount++;
+
+        // 1 自旋
+        bool ready = false;
+        uint64_t now = start;
+        if (spin > 0)
+        {
+            // 至少检查一次，adaptive时avgGapNs才能重新变小
+            while (true)
+            {
+                if (hasPendingTasks())
+                {
+                    ready = true;
+                    break;
+                }
+                if (now - start >= spin)
+                {
+                    break;
+                }
+                for (int i = 0; i < 16; ++i)
+                {
+#if defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+#endif
+                }
+                now = NowNs();
+            }
+            now = NowNs();
+            c->spinNs += now - start;
+            if (ready)
+            {
+                c->spinWakeups++;
+            }
+        }
+
+        // 2 非阻塞轮询
+        if (!ready && polls > 0)
+        {
+            uint64_t poll_start = now;
+            for (uint32_t i = 0; i < polls && !ready; ++i)
+            {
+                ready = poll() || hasPendingTasks();
+            }
+            now = NowNs();
+            c->pollNs += now - poll_start;
+            if (ready)
+            {
+                c->pollWakeups++;
+            }
+        }
+
+        m_spinningThreadCount--;
+        // 退出自旋状态之后再检查一次：scheduleLock()先更新m_taskCount再检查m_spinningThreadCount -> 不会丢失唤醒
+        if (!ready && hasPendingTasks())
+        {
+            ready = true;
+            c->spinWakeups++;
+        }
+
+        if (ready)
+        {
+            c->avgGapNs += ((int64_t)(now - start) - (int64_t)c->avgGapNs) / 8;
+        }
+        else
+        {
+            c->blockStart = now;
+        }
+        return ready;
+    }
+
+    bool Scheduler::idleBusyPoll(const std::function<bool()> &poll)
+    {
+        IdleCounters *c = t_idleCounters;
+        uint64_t start = NowNs();
+
+        // 一直处于自旋状态 -> scheduleLock()不会tickle()
+        m_spinningThreadCount++;
+        bool ready = false;
+        for (uint64_t i = 1;; ++i)
+        {
+            if (hasPendingTasks() || (poll && poll()))
+            {
+                ready = true;
+                break;
+            }
+            // stopping()需要加锁 -> 不用每轮都检查
+            if (i % 64 == 0 && stopping())
+            {
+                break;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        m_spinningThreadCount--;
+
+        c->pollNs += NowNs() - start;
+        if (ready)
+        {
+            c->pollWakeups++;
+        }
+        return ready;
+    }
+
+    void Scheduler::idleBlocked()
+    {
+        IdleCounters *c = t_idleCounters;
+        uint64_t now = NowNs();
+        c->blockNs += now - c->blockStart;
+        c->blockWakeups++;
+
+        // 间隔过长的样本截断 -> 到达变频繁时能较快恢复自旋
+        uint64_t gap = std::min<uint64_t>(now - c->idleStart, m_idlePolicy.spinUs * 4000ull);
+        c->avgGapNs += ((int64_t)gap - (int64_t)c->avgGapNs) / 8;
     }
 
     bool Scheduler::stopping()
     {
+        RuntimeScope scope;
         std::lock_guard<std::mutex> lock(m_mutex);
         return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
     }
@@ -5,12 +5,55 @@
 #include "hook.h"
 #include "thread.h"
 
+#include <deque>
+#include <map>
 #include <mutex>
+#include <set>
 #include <vector>
 
 namespace sylar
 {
 
+	// 空闲策略：任务队列为空时 1 自旋 -> 2 非阻塞轮询 -> 3 阻塞，默认直接阻塞
+	struct IdlePolicy
+	{
+		// 自旋的最长时间(微秒)，0 -> 不自旋
+		uint32_t spinUs = 0;
+		// 自旋之后非阻塞轮询的次数，IOManager -> epoll_wait超时为0
+		uint32_t pollCount = 0;
+		// 根据最近的任务到达间隔缩短自旋时间，最长为spinUs
+		bool adaptive = true;
+
+		// 忙轮询：空闲时从不阻塞，一直轮询任务队列(IOManager -> 还有超时为0的epoll_wait和定时器)
+		// 适合独占CPU核的部署，设置后忽略以上三项，时间计入pollNs
+		bool busyPoll = false;
+		// 忙轮询时给注册事件的socket设置SO_BUSY_POLL(微秒)，0 -> 不设置
+		uint32_t socketBusyPollUs = 0;
+	};
+
+	// 工作线程在空闲各阶段花费的时间(纳秒)，以及在该阶段等到任务的次数
+	struct IdleStats
+	{
+		uint64_t spinNs = 0;
+		uint64_t pollNs = 0;
+		uint64_t blockNs = 0;
+		uint64_t spinWakeups = 0;
+		uint64_t pollWakeups = 0;
+		uint64_t blockWakeups = 0;
+	};
+
+	// 弹性线程池：队列中最早的任务等待超过growAfterMs时新增一个工作线程，总数最多maxThreads(包括use_caller的主线程)
+	// 构造时的线程数为下限，这些线程不会退出；新增的线程空闲retireAfterMs后退出，忙轮询时不退出
+	struct ElasticPolicy
+	{
+		// 0 -> 不启用
+		size_t maxThreads = 0;
+		uint64_t growAfterMs = 10;
+		uint64_t retireAfterMs = 5000;
+	};
+
+	struct IdleCounters;
+
 	class Scheduler
 	{
 	public:
@@ -20,9 +63,30 @@ namespace sylar
 
 		const std::string &getName() const { return m_name; }
 
+		// 工作线程id，start()之后有效
+		const std::vector<int> &getThreadIds() const { return m_threadIds; }
+		// use_caller时的主线程id(也在getThreadIds()中，只在stop()中运行任务)，否则为-1
+		int getRootThread() const { return m_rootThread; }
+
+		// start()之前设置，IOManager在构造时传入
+		void setIdlePolicy(const IdlePolicy &policy) { m_idlePolicy = policy; }
+		const IdlePolicy &getIdlePolicy() const { return m_idlePolicy; }
+		// 工作线程thread的空闲统计，该线程尚未运行时全为0
+		IdleStats getIdleStats(int thread);
+
+		// start()之前设置：第i个新建的工作线程绑定到cpus[i % cpus.size()]，use_caller时的主线程不绑定
+		// 只绑定线程：协程栈和任务队列的内存不保证来自线程所在的NUMA节点(malloc可能复用其他线程释放的内存)
+		// 按NUMA节点绑定 -> 传入Thread::GetNumaNodes()，工作线程轮流绑定到各个节点的全部CPU
+		void setWorkerCpus(const std::vector<std::vector<int>> &cpus) { m_workerCpus = cpus; }
+
+		// 可以在start()之后设置，之后新增的线程使用新的retireAfterMs
+		void setElasticPolicy(const ElasticPolicy &policy);
+
 	public:
 		// 获取正在运行的调度器
 		static Scheduler *GetThis();
+		// 正在运行的任务协程，在调度协程或idle协程中 -> nullptr
+		static Fiber *GetRunningTask();
 
 	protected:
 		// 设置正在运行的调度器
@@ -34,18 +98,33 @@ namespace sylar
 		void scheduleLock(FiberOrCb fc, int thread = -1)
 		{
 			bool need_tickle; // 用于标记任务队列是否为空，从而判断是否需要唤醒线程
+			RuntimeScope scope;
 			std::lock_guard<std::mutex> lock(m_mutex);
 			// empty ->  all thread is idle -> need to be waken up
-			need_tickle = m_tasks.empty();
+			// 指定线程的任务 -> 队列中已有的任务可能都不属于那个线程，它不会因此被唤醒
+			need_tickle = m_tasks.empty() || thread != -1;
+
+			// 指定的弹性线程已经退出 -> 交给任意线程，否则永远不会运行
+			if (thread != -1 && !m_retiredIds.empty() && m_retiredIds.count(thread))
+			{
+				thread = -1;
+			}
 
 			// 创建Task的任务对象
 			ScheduleTask task(fc, thread);
 			if (task.fiber || task.cb)
 			{
+				// 弹性线程池根据入队时间判断是否需要新增线程
+				if (m_elastic.maxThreads)
+				{
+					task.enqueued = NowMs();
+				}
 				m_tasks.push_back(task);
+				m_taskCount = m_tasks.size();
 			}
 
-			if (need_tickle)
+			// 有线程在自旋 -> 它会看到新任务，不需要唤醒
+			if (need_tickle && m_spinningThreadCount == 0)
 			{
 				tickle();
 			}
@@ -71,6 +150,24 @@ namespace sylar
 		// 返回是否有空闲线程
 		bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
+		// 任务队列是否非空，不加锁
+		bool hasPendingTasks() { return m_taskCount > 0; }
+
+		// 空闲策略的第1、2阶段：自旋，然后调用poll轮询pollCount次(poll返回true -> 有事件)
+		// 等到任务或事件时返回true；返回false时调用方进入第3阶段阻塞，醒来后调用idleBlocked()
+		bool idleSpin(const std::function<bool()> &poll = nullptr);
+		void idleBlocked();
+		// 忙轮询：直到有任务或者poll返回true时返回true，可以关闭时返回false
+		bool idleBusyPoll(const std::function<bool()> &poll = nullptr);
+
+		// 当前线程是弹性线程时返回其空闲退出时间，否则返回0
+		uint64_t retireAfterMs() const;
+		// 弹性线程空闲超时之后调用，返回true -> 退出idle()，随后线程结束
+		bool tryRetire();
+
+		// 单调时钟的毫秒数
+		static uint64_t NowMs();
+
 	private:
 		// 任务
 		struct ScheduleTask
@@ -78,6 +175,7 @@ namespace sylar
 			std::shared_ptr<Fiber> fiber;
 			std::function<void()> cb;
 			int thread; // 指定任务需要运行的线程id
+			uint64_t enqueued = 0; // 入队时间(毫秒)，只在启用弹性线程池时记录
 
 			ScheduleTask()
 			{
@@ -116,9 +214,15 @@ namespace sylar
 				fiber = nullptr;
 				cb = nullptr;
 				thread = -1;
+				enqueued = 0;
 			}
 		};
 
+		// 创建第index个工作线程，retire_ms > 0 -> 弹性线程
+		std::shared_ptr<Thread> newWorker(size_t index, uint64_t retire_ms);
+		// 弹性线程池的监控线程：检查队列等待时间，回收已退出的弹性线程
+		void monitor();
+
 	private:
 		// 调度器名称
 		std::string m_name;
@@ -126,8 +230,8 @@ namespace sylar
 		std::mutex m_mutex;
 		// 线程池
 		std::vector<std::shared_ptr<Thread>> m_threads;
-		// 任务队列
-		std::vector<ScheduleTask> m_tasks;
+		// 任务队列，从队首取任务 -> deque，大量任务排队时出队不搬移其余任务
+		std::deque<ScheduleTask> m_tasks;
 		// 存储工作线程的线程id
 		std::vector<int> m_threadIds;
 		// 需要额外创建的线程数
@@ -145,6 +249,31 @@ namespace sylar
 		int m_rootThread = -1;
 		// 是否正在关闭
 		bool m_stopping = false;
+		// 空闲线程在此休眠，tickle()每次唤醒一个
+		FutexEvent m_idleEvent;
+
+		IdlePolicy m_idlePolicy;
+		// 任务队列长度，空闲线程自旋时不加锁读取
+		std::atomic<size_t> m_taskCount = {0};
+		// 处于自旋/轮询阶段的线程数
+		std::atomic<size_t> m_spinningThreadCount = {0};
+		// 线程id -> 空闲统计，由m_mutex保护
+		std::map<int, std::unique_ptr<IdleCounters>> m_idleCounters;
+		// 工作线程绑定的CPU集合
+		std::vector<std::vector<int>> m_workerCpus;
+
+		bool m_started = false;
+		ElasticPolicy m_elastic;
+		// 弹性线程：线程id -> 线程
+		std::map<int, std::shared_ptr<Thread>> m_elasticThreads;
+		// 已经退出、等待join的弹性线程
+		std::vector<std::shared_ptr<Thread>> m_retiredThreads;
+		// 已经退出的弹性线程id，指定给它们的任务改为任意线程运行
+		std::set<int> m_retiredIds;
+		// 弹性线程的编号
+		size_t m_elasticSeq = 0;
+		std::shared_ptr<Thread> m_monitor;
+		FutexEvent m_monitorEvent;
 	};
 
 }
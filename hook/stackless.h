@@ -0,0 +1,393 @@
+#ifndef _STACKLESS_H_
+#define _STACKLESS_H_
+
+#include "future.h"
+#include "ioscheduler.h"
+
+#if !defined(__cpp_impl_coroutine)
+#error "stackless.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include <cerrno>
+#include <coroutine>
+#include <utility>
+
+// 无栈协程适配：与有栈的Fiber在同一个调度器上运行
+// 挂起的Task只保留其协程帧(几百字节)，没有独立的栈；恢复时作为回调任务在工作线程的回调协程上运行到下一个挂起点
+// 库本身仍按C++17编译 -> 只有包含本头文件的代码需要-std=c++20
+// work flow
+// 1 co_spawn(scheduler, task) -> 2 task在调度器上开始运行 -> 3 co_await readable(fd)/sleep_for(ms)挂起，事件或定时器触发时重新调度
+// -> 4 task结束 -> 结果写入co_spawn()返回的Future
+
+namespace sylar
+{
+
+    template <typename T = void>
+    class Task;
+
+    namespace detail
+    {
+
+        struct TaskPromiseBase
+        {
+            // co_await本任务的协程，结束时对称转移回去
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept { return false; }
+
+                template <typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+                {
+                    std::coroutine_handle<> next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            // 惰性启动：co_await时才开始运行
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        template <typename T>
+        struct TaskPromise : TaskPromiseBase
+        {
+            std::optional<T> value;
+
+            Task<T> get_return_object();
+
+            template <typename U>
+            void return_value(U &&v)
+            {
+                value.emplace(std::forward<U>(v));
+            }
+
+            T result()
+            {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+                return std::move(*value);
+            }
+        };
+
+        template <>
+        struct TaskPromise<void> : TaskPromiseBase
+        {
+            Task<void> get_return_object();
+
+            void return_void() const noexcept {}
+
+            void result()
+            {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+
+    }
+
+    // 无栈协程任务，只能co_await一次；析构时销毁协程帧
+    template <typename T>
+    class Task
+    {
+    public:
+        using promise_type = detail::TaskPromise<T>;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        explicit Task(handle_type h) : m_handle(h) {}
+        Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+        Task &operator=(Task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (m_handle)
+                {
+                    m_handle.destroy();
+                }
+                m_handle = std::exchange(other.m_handle, nullptr);
+            }
+            return *this;
+        }
+        ~Task()
+        {
+            if (m_handle)
+            {
+                m_handle.destroy();
+            }
+        }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        auto operator co_await() && noexcept
+        {
+            struct Awaiter
+            {
+                handle_type h;
+
+                bool await_ready() const noexcept { return !h || h.done(); }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+                {
+                    h.promise().continuation = caller;
+                    return h;
+                }
+
+                T await_resume() { return h.promise().result(); }
+            };
+            return Awaiter{m_handle};
+        }
+
+    private:
+        handle_type m_handle;
+    };
+
+    namespace detail
+    {
+
+        template <typename T>
+        Task<T> TaskPromise<T>::get_return_object()
+        {
+            return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> TaskPromise<void>::get_return_object()
+        {
+            return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+        }
+
+        // 立即启动，结束后自行销毁协程帧
+        struct DetachedTask
+        {
+            struct promise_type
+            {
+                DetachedTask get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+        };
+
+        // 带超时的IO事件等待的共享状态
+        // 定时器认领之后 -> 事件回调与取消事件的一方都结束，后到的一方才恢复协程 -> cancelEvent()不会误伤恢复之后的新注册
+        struct EventWaitState
+        {
+            enum Stage
+            {
+                REGISTERING = 0,
+                REGISTERED = 1,
+                EXPIRED = 2
+            };
+
+            // 事件回调与定时器谁先认领
+            std::atomic<bool> claimed = {false};
+            // 注册与定时器到期谁先发生 -> 后到的一方调用cancelEvent()
+            std::atomic<int> stage = {REGISTERING};
+            std::atomic<bool> done = {false};
+            bool timedout = false;
+            std::shared_ptr<Timer> timer;
+        };
+
+    }
+
+    // co_await resume_on(scheduler) -> 当前协程转到scheduler上继续运行
+    struct ScheduleAwaiter
+    {
+        Scheduler *scheduler;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) const { scheduler->scheduleLock([h]() { h.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+
+    inline ScheduleAwaiter resume_on(Scheduler *scheduler)
+    {
+        assert(scheduler != nullptr);
+        return ScheduleAwaiter{scheduler};
+    }
+
+    // co_await readable(fd) / writable(fd)：等待fd就绪，成功返回0
+    // 超时 -> -1，errno为ETIMEDOUT；注册事件失败 -> -1
+    // fd被关闭时事件被取消 -> 同样返回0，由随后的读写报告错误
+    struct EventAwaiter
+    {
+        EventAwaiter(IOManager *iom, int fd, IOManager::Event event, uint64_t timeout_ms)
+            : iom(iom), fd(fd), event(event), timeout_ms(timeout_ms) {}
+
+        IOManager *iom;
+        int fd;
+        IOManager::Event event;
+        uint64_t timeout_ms;
+        int result = 0;
+        // 只有带超时的等待才分配
+        std::shared_ptr<detail::EventWaitState> state;
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            assert(iom != nullptr);
+            if (timeout_ms == (uint64_t)-1)
+            {
+                // 注册成功之后协程可能已经在其他线程恢复 -> 不能再访问本对象
+                int rt = iom->addEvent(fd, event, [h]()
+                                       { h.resume(); });
+                if (rt)
+                {
+                    result = rt;
+                    return false;
+                }
+                return true;
+            }
+
+            // 1 先启动定时器 -> 2 再注册事件 -> 恢复之后才读取state
+            state = std::make_shared<detail::EventWaitState>();
+            std::shared_ptr<detail::EventWaitState> s = state;
+            IOManager *m = iom;
+            int f = fd;
+            IOManager::Event e = event;
+            s->timer = iom->addTimer(timeout_ms, [s, m, f, e, h]()
+                                     {
+                if (s->claimed.exchange(true))
+                {
+                    return;
+                }
+                s->timedout = true;
+                // 事件还在注册中 -> 由注册的一方取消
+                if (s->stage.exchange(detail::EventWaitState::EXPIRED) != detail::EventWaitState::REGISTERED)
+                {
+                    return;
+                }
+                m->cancelEvent(f, e);
+                if (s->done.exchange(true))
+                {
+                    h.resume();
+                } });
+
+            int rt = iom->addEvent(fd, event, [s, h]()
+                                   {
+                if (!s->claimed.exchange(true) || s->done.exchange(true))
+                {
+                    h.resume();
+                } });
+            if (rt)
+            {
+                if (!s->claimed.exchange(true))
+                {
+                    s->timer->cancel();
+                }
+                result = rt;
+                return false;
+            }
+            // 注册成功之后协程可能已经恢复 -> 只访问局部变量
+            if (s->stage.exchange(detail::EventWaitState::REGISTERED) != detail::EventWaitState::EXPIRED)
+            {
+                return true;
+            }
+            m->cancelEvent(f, e);
+            // 事件回调已经结束 -> 不挂起
+            return !s->done.exchange(true);
+        }
+
+        int await_resume()
+        {
+            if (state)
+            {
+                state->timer->cancel();
+            }
+            if (result)
+            {
+                return result;
+            }
+            if (state && state->timedout)
+            {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            return 0;
+        }
+    };
+
+    inline EventAwaiter readable(int fd, uint64_t timeout_ms = (uint64_t)-1, IOManager *iom = IOManager::GetThis())
+    {
+        return EventAwaiter{iom, fd, IOManager::READ, timeout_ms};
+    }
+
+    inline EventAwaiter writable(int fd, uint64_t timeout_ms = (uint64_t)-1, IOManager *iom = IOManager::GetThis())
+    {
+        return EventAwaiter{iom, fd, IOManager::WRITE, timeout_ms};
+    }
+
+    // co_await sleep_for(ms)：定时器到期后在iom上恢复
+    struct SleepAwaiter
+    {
+        IOManager *iom;
+        uint64_t ms;
+
+        bool await_ready() const noexcept { return ms == 0; }
+        void await_suspend(std::coroutine_handle<> h) const
+        {
+            assert(iom != nullptr);
+            iom->addTimer(ms, [h]()
+                          { h.resume(); });
+        }
+        void await_resume() const noexcept {}
+    };
+
+    inline SleepAwaiter sleep_for(uint64_t ms, IOManager *iom = IOManager::GetThis())
+    {
+        return SleepAwaiter{iom, ms};
+    }
+
+    namespace detail
+    {
+
+        template <typename T>
+        DetachedTask run_task(Scheduler *scheduler, Task<T> task, Promise<T> promise)
+        {
+            co_await resume_on(scheduler);
+            try
+            {
+                if constexpr (std::is_void<T>::value)
+                {
+                    co_await std::move(task);
+                    promise.setValue();
+                }
+                else
+                {
+                    promise.setValue(co_await std::move(task));
+                }
+            }
+            catch (...)
+            {
+                promise.setException(std::current_exception());
+            }
+        }
+
+    }
+
+    // 在scheduler上运行task，与协程、回调任务混合调度
+    // 返回的Future可以在协程中get()(挂起协程)，也可以在Task中通过then()衔接
+    template <typename T>
+    Future<T> co_spawn(Scheduler *scheduler, Task<T> task)
+    {
+        assert(scheduler != nullptr);
+        Promise<T> promise;
+        Future<T> future = promise.getFuture();
+        detail::run_task(scheduler, std::move(task), std::move(promise));
+        return future;
+    }
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include "task_group.h"
+#include "hook.h"
+
+namespace sylar
+{
+
+    TaskGroup::TaskGroup(Scheduler *scheduler) : m_scheduler(scheduler), m_token(std::make_shared<CancelToken>())
+    {
+        assert(m_scheduler != nullptr);
+
+        m_parent = CancelToken::GetThis();
+        if (m_parent)
+        {
+            // 只捕获组的令牌 -> 不依赖本对象的生命周期
+            CancelToken::ptr token = m_token;
+            m_parentWaiter = m_parent->addWaiter([token]()
+                                                 { token->cancel(); });
+            if (m_parentWaiter == 0)
+            {
+                m_token->cancel();
+            }
+        }
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        m_wg.wait();
+        if (m_parent && m_parentWaiter)
+        {
+            m_parent->removeWaiter(m_parentWaiter);
+        }
+    }
+
+    void TaskGroup::spawn(std::function<void()> fn)
+    {
+        m_wg.add(1);
+        uint64_t deadline = get_deadline();
+        m_scheduler->scheduleLock([this, fn, deadline]()
+                                  {
+            CancelToken::SetThis(m_token);
+            {
+                DeadlineScope scope(deadline, true);
+                try
+                {
+                    fn();
+                }
+                catch (...)
+                {
+                    setError(std::current_exception());
+                }
+            }
+            CancelToken::SetThis(nullptr);
+            // 最后一步 -> 之后创建者可能已经析构本对象
+            m_wg.done(); });
+    }
+
+    void TaskGroup::wait()
+    {
+        m_wg.wait();
+
+        std::exception_ptr error;
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            error = m_error;
+            m_error = nullptr;
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    void TaskGroup::setError(std::exception_ptr error)
+    {
+        {
+            RuntimeScope scope;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_error)
+            {
+                return;
+            }
+            m_error = error;
+        }
+        m_token->cancel();
+    }
+
+}
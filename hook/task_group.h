@@ -0,0 +1,52 @@
+#ifndef _TASK_GROUP_H_
+#define _TASK_GROUP_H_
+
+#include "fiber_sync.h"
+
+#include <exception>
+
+namespace sylar
+{
+
+    // 任务组：一次扇出的一组子协程，子协程不会比任务组活得更久
+    // work flow
+    // 1 spawn() 子协程继承任务组的取消令牌和创建者当前的截止时间
+    // 2 第一个抛出异常的子协程 -> 记录异常并取消整个组 -> 其余子协程挂起的钩子调用以ECANCELED返回
+    // 3 wait() 挂起创建者直到所有子协程结束，重新抛出第一个异常
+    // 创建者自己的取消令牌被取消 -> 同时取消整个组
+    class TaskGroup
+    {
+    public:
+        // scheduler: 子协程运行的调度器，默认为当前调度器
+        explicit TaskGroup(Scheduler *scheduler = Scheduler::GetThis());
+        // 等待所有子协程结束，不抛出异常
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        void spawn(std::function<void()> fn);
+        void wait();
+        void cancel() { m_token->cancel(); }
+
+        bool isCancelled() const { return m_token->isCancelled(); }
+        const CancelToken::ptr &getToken() const { return m_token; }
+
+    private:
+        void setError(std::exception_ptr error);
+
+    private:
+        Scheduler *m_scheduler;
+        CancelToken::ptr m_token;
+        // 创建者的令牌及在其上登记的唤醒函数
+        CancelToken::ptr m_parent;
+        uint64_t m_parentWaiter = 0;
+        WaitGroup m_wg;
+
+        std::mutex m_mutex;
+        std::exception_ptr m_error;
+    };
+
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include "tcp_server.h"
+#include "fd_manager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static bool debug = false;
+
+namespace sylar
+{
+
+    TcpServer::TcpServer(IOManager *iom, const std::string &name) : m_iom(iom), m_name(name)
+    {
+        assert(m_iom != nullptr);
+    }
+
+    TcpServer::~TcpServer()
+    {
+        // started -> the derived destructor must have stopped the server, see tcp_server.h
+        assert(m_stopping);
+        // close listeners bound but never started
+        stop();
+    }
+
+    bool TcpServer::bind(const struct sockaddr *addr, socklen_t addrlen, int backlog)
+    {
+        assert(m_listenFds.empty());
+
+        // port 0 -> the first listener picks the port and the others share it
+        sockaddr_storage bound;
+        memcpy(&bound, addr, addrlen);
+
+        // the use_caller thread runs tasks only inside IOManager::stop() -> no listener of its own
+        // unless there is no other worker, then its accept fiber is left unpinned
+        std::vector<int> threads;
+        for (int thread : m_iom->getThreadIds())
+        {
+            if (thread != m_iom->getRootThread())
+            {
+                threads.push_back(thread);
+            }
+        }
+        if (threads.empty())
+        {
+            threads.push_back(-1);
+        }
+
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (fd == -1)
+            {
+                std::cerr << "TcpServer::bind socket() failed: " << strerror(errno) << std::endl;
+                stop();
+                return false;
+            }
+
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+            if (::bind(fd, (sockaddr *)&bound, addrlen) || listen(fd, backlog))
+            {
+                std::cerr << "TcpServer::bind bind/listen failed: " << strerror(errno) << std::endl;
+                close(fd);
+                stop();
+                return false;
+            }
+
+            if (i == 0)
+            {
+                socklen_t len = addrlen;
+                getsockname(fd, (sockaddr *)&bound, &len);
+            }
+
+            // register with FdMgr -> the hooked accept parks the fiber instead of the worker
+            FdMgr::GetInstance()->addSocket(fd);
+            m_listenFds.push_back(fd);
+            m_listenThreads.push_back(threads[i]);
+        }
+        return true;
+    }
+
+    bool TcpServer::start()
+    {
+        if (!m_stopping)
+        {
+            return true;
+        }
+        if (m_listenFds.empty())
+        {
+            std::cerr << "TcpServer::start() no listener bound" << std::endl;
+            return false;
+        }
+
+        m_stopping = false;
+        m_cancel = std::make_shared<CancelToken>();
+        m_acceptors.add(m_listenFds.size());
+
+        for (size_t i = 0; i < m_listenFds.size(); ++i)
+        {
+            m_iom->scheduleLock(std::bind(&TcpServer::startAccept, this, m_listenFds[i], m_listenThreads[i]), m_listenThreads[i]);
+        }
+        return true;
+    }
+
+    void TcpServer::stop()
+    {
+        bool started = !m_stopping.exchange(true);
+        if (started)
+        {
+            // a parked accept or backoff returns with ECANCELED and its fiber closes the listener
+            m_cancel->cancel();
+        }
+        else
+        {
+            for (int fd : m_listenFds)
+            {
+                FdMgr::GetInstance()->del(fd);
+                close(fd);
+            }
+        }
+        m_listenFds.clear();
+        m_listenThreads.clear();
+
+        if (started)
+        {
+            // the accept fibers add to m_handlers before they finish -> wait for them first
+            m_acceptors.wait();
+            m_handlers.wait();
+        }
+    }
+
+    void TcpServer::handleClient(int client)
+    {
+        close(client);
+    }
+
+    void TcpServer::runClient(int client)
+    {
+        CancelToken::SetThis(m_cancel);
+        handleClient(client);
+        CancelToken::SetThis(nullptr);
+        // last access to this -> stop() may return and the server be destroyed
+        m_handlers.done();
+    }
+
+    void TcpServer::startAccept(int listen_fd, int thread)
+    {
+        if (debug)
+            std::cout << "TcpServer::startAccept(" << listen_fd << ") in thread: " << Thread::GetThreadId() << std::endl;
+
+        CancelToken::SetThis(m_cancel);
+        std::vector<int> clients;
+        uint64_t backoff_ms = 0;
+        while (!m_stopping)
+        {
+            // a readiness wakeup resumes the fiber on whichever worker polled it -> move back to the pinned one
+            if (thread != -1 && Thread::GetThreadId() != thread)
+            {
+                m_iom->scheduleLock(Fiber::GetThis(), thread);
+                Fiber::GetThis()->yield();
+                continue;
+            }
+
+            // take every pending connection per wakeup
+            clients.clear();
+            if (accept_batch(listen_fd, clients) == -1)
+            {
+                if (m_stopping)
+                {
+                    break;
+                }
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    // out of fds or memory -> the connection stays in the backlog and the listener stays ready,
+                    // so pause (doubling up to 1s) instead of spinning on it
+                    if (backoff_ms == 0)
+                    {
+                        std::cerr << "TcpServer::accept(" << listen_fd << ") failed: " << strerror(errno) << ", backing off" << std::endl;
+                    }
+                    backoff_ms = std::min<uint64_t>(backoff_ms ? backoff_ms * 2 : 10, 1000);
+                    usleep(backoff_ms * 1000);
+                }
+                else if (errno != ECANCELED)
+                {
+                    std::cerr << "TcpServer::accept(" << listen_fd << ") failed: " << strerror(errno) << std::endl;
+                }
+                continue;
+            }
+            backoff_ms = 0;
+
+            // stay on the listener's worker
+            for (int client : clients)
+            {
+                m_handlers.add();
+                m_iom->scheduleLock(std::bind(&TcpServer::runClient, this, client), thread);
+            }
+        }
+
+        CancelToken::SetThis(nullptr);
+        close(listen_fd);
+        m_acceptors.done();
+    }
+
+} // end namespace sylar
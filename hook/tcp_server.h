@@ -0,0 +1,64 @@
+#ifndef __SYLAR_TCP_SERVER_H__
+#define __SYLAR_TCP_SERVER_H__
+
+#include "fiber_sync.h"
+#include "ioscheduler.h"
+
+#include <sys/socket.h>
+#include <vector>
+
+namespace sylar
+{
+
+    // one SO_REUSEPORT listener per worker thread -> the kernel spreads incoming connections across them
+    // work flow
+    // 1 bind one listener per worker -> 2 one accept fiber per listener, pinned to its worker -> 3 hand each connection to a handler fiber on that worker
+    // use_caller: the caller thread only runs tasks inside IOManager::stop() -> it gets no listener, unless it is the only worker
+    // stop() waits for the accept fibers and the handlers -> call it before the IOManager stops, not from a handler,
+    // and not from a use_caller thread that is its only worker
+    // derived classes call stop() in their own destructor: ~TcpServer runs after the derived part is gone,
+    // so a handler still running then would call handleClient() on a destroyed object
+    class TcpServer
+    {
+    public:
+        TcpServer(IOManager *iom = IOManager::GetThis(), const std::string &name = "TcpServer");
+        virtual ~TcpServer();
+
+        // create and bind the listeners, one per worker thread of iom
+        bool bind(const struct sockaddr *addr, socklen_t addrlen, int backlog = SOMAXCONN);
+        // schedule the accept fibers
+        bool start();
+        // wake up the accept fibers and the handlers, wait until the listeners are closed and every handler has returned
+        void stop();
+
+        const std::string &getName() const { return m_name; }
+        bool isStopping() const { return m_stopping; }
+
+    protected:
+        // runs in its own fiber on the worker of the accepting listener, owns client
+        // hooked waits return ECANCELED once stop() is called
+        virtual void handleClient(int client);
+
+    private:
+        // accept fiber of one listener, thread -> the worker it is pinned to, -1 -> any
+        void startAccept(int listen_fd, int thread);
+        // handler fiber: handleClient() counted in m_handlers
+        void runClient(int client);
+
+    private:
+        IOManager *m_iom;
+        std::string m_name;
+        // listener fds, one per worker thread
+        std::vector<int> m_listenFds;
+        // the worker each listener's accept fiber is pinned to, -1 -> any
+        std::vector<int> m_listenThreads;
+        std::atomic<bool> m_stopping = {true};
+        // shared by the accept fibers and the handlers -> stop() wakes them from accept, a backoff sleep or client I/O
+        CancelToken::ptr m_cancel;
+        WaitGroup m_acceptors;
+        WaitGroup m_handlers;
+    };
+
+} // end namespace sylar
+
+#endif
@@ -0,0 +1,131 @@
+// 取消令牌：cancel()让挂起在recv上的协程以ECANCELED返回、之后的等待立即返回、一个令牌取消一组协程而不影响其他协程
+// g++ -std=c++17 -I.. test_cancel.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "ioscheduler.h"
+#include "fd_manager.h"
+#include "fiber_sync.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 挂起在recv上 -> cancel()之后以ECANCELED返回；fd上的事件已经注销，去掉令牌之后同一个fd照常可读
+void test_cancel_recv()
+{
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    // 非阻塞并注册到FdMgr -> recv()挂起协程而不是阻塞工作线程
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    FdMgr::GetInstance()->addSocket(sv[0]);
+    CancelToken::ptr token = std::make_shared<CancelToken>();
+    {
+        IOManager iom(2, false, "cancel_recv");
+        Semaphore done;
+        iom.scheduleLock([&]()
+                         {
+            CancelToken::SetThis(token);
+            char ch;
+            uint64_t start = now_ms();
+            assert(recv(sv[0], &ch, 1, 0) == -1 && errno == ECANCELED);
+            uint64_t elapsed = now_ms() - start;
+            assert(elapsed >= 40 && elapsed < 1000);
+
+            // 已经取消 -> 新的等待立即返回
+            start = now_ms();
+            assert(recv(sv[0], &ch, 1, 0) == -1 && errno == ECANCELED);
+            assert(usleep(1000000) == -1 && errno == ECANCELED);
+            assert(now_ms() - start < 100);
+
+            CancelToken::SetThis(nullptr);
+            assert(write(sv[1], "x", 1) == 1);
+            assert(recv(sv[0], &ch, 1, 0) == 1 && ch == 'x');
+            done.signal(); });
+        iom.addTimer(50, [token]()
+                     { token->cancel(); });
+        done.wait();
+        assert(token->isCancelled());
+    }
+    close(sv[0]);
+    close(sv[1]);
+}
+
+// 共享同一个令牌的协程挂起在不同的调用上，一次cancel()全部返回；没有令牌的协程不受影响
+void test_cancel_group()
+{
+    CancelToken::ptr token = std::make_shared<CancelToken>();
+    std::atomic<int> cancelled = {0};
+    std::atomic<bool> untouched = {false};
+    int p[2];
+    assert(pipe(p) == 0);
+    uint64_t start = now_ms();
+    {
+        IOManager iom(2, false, "cancel_group");
+        WaitGroup wg;
+        wg.add(4);
+        iom.scheduleLock([&]()
+                         {
+            CancelToken::SetThis(token);
+            if (usleep(5000000) == -1 && errno == ECANCELED)
+            {
+                ++cancelled;
+            }
+            wg.done(); });
+        iom.scheduleLock([&]()
+                         {
+            CancelToken::SetThis(token);
+            pollfd pfd = {p[0], POLLIN, 0};
+            if (poll(&pfd, 1, 5000) == -1 && errno == ECANCELED)
+            {
+                ++cancelled;
+            }
+            wg.done(); });
+        iom.scheduleLock([&]()
+                         {
+            CancelToken::SetThis(token);
+            int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            assert(bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+            assert(listen(listen_fd, 4) == 0);
+            if (accept(listen_fd, nullptr, nullptr) == -1 && errno == ECANCELED)
+            {
+                ++cancelled;
+            }
+            close(listen_fd);
+            wg.done(); });
+        iom.scheduleLock([&]()
+                         {
+            untouched = usleep(200000) == 0;
+            wg.done(); });
+
+        iom.addTimer(50, [token]()
+                     { token->cancel(); });
+        wg.wait();
+    }
+    assert(cancelled == 3);
+    assert(untouched);
+    assert(now_ms() - start < 1000);
+    close(p[0]);
+    close(p[1]);
+}
+
+int main()
+{
+    test_cancel_recv();
+    test_cancel_group();
+    std::cout << "test_cancel ok" << std::endl;
+    return 0;
+}
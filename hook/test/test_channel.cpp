@@ -0,0 +1,252 @@
+// 通道与select：无缓冲的交接、close()唤醒挂起的收发方、UNBOUNDED、select之间争抢同一个值、select超时
+// g++ -std=c++17 -I.. test_channel.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "channel.h"
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 在IOManager上运行f，返回时f已经结束
+template <typename F>
+static void run_in_fiber(F f)
+{
+    IOManager iom(2, false, "channel");
+    Semaphore done;
+    iom.scheduleLock([&]()
+                     {
+        f(iom);
+        done.signal(); });
+    done.wait();
+}
+
+// 无缓冲：发送方挂起到接收方取走值为止，只能移动的值直接交给接收方
+void test_rendezvous()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        Channel<std::unique_ptr<int>> ch;
+        iom.scheduleLock([&]()
+                         {
+            usleep(30000);
+            std::unique_ptr<int> v;
+            assert(ch.recv(v));
+            assert(*v == 7); });
+
+        uint64_t start = now_ms();
+        assert(ch.send(std::make_unique<int>(7)));
+        assert(now_ms() - start >= 25);
+
+        // 没有接收方 -> trySend失败且不取走值
+        std::unique_ptr<int> v = std::make_unique<int>(8);
+        assert(!ch.trySend(v));
+        assert(v && *v == 8); });
+}
+
+// close()：挂起的接收方和发送方都以false返回，缓冲区中的值仍然可以取走
+void test_close_wakes()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        Channel<int> empty(1);
+        Channel<int> full(1);
+        assert(full.send(1));
+        WaitGroup wg;
+        std::atomic<int> failed = {0};
+        wg.add(6);
+        for (int i = 0; i < 3; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                int v;
+                if (!empty.recv(v))
+                {
+                    ++failed;
+                }
+                wg.done(); });
+            iom.scheduleLock([&]()
+                             {
+                if (!full.send(2))
+                {
+                    ++failed;
+                }
+                wg.done(); });
+        }
+        usleep(30000);
+        assert(failed == 0);
+
+        empty.close();
+        full.close();
+        wg.wait();
+        assert(failed == 6);
+
+        int v = 0;
+        assert(full.recv(v) && v == 1);
+        assert(!full.recv(v));
+        assert(!full.send(3));
+        assert(full.isClosed()); });
+}
+
+// UNBOUNDED：没有接收方时发送也不挂起，按发送顺序取出
+void test_unbounded()
+{
+    run_in_fiber([](IOManager &)
+                 {
+        Channel<int> ch(Channel<int>::UNBOUNDED);
+        for (int i = 0; i < 10000; ++i)
+        {
+            assert(ch.send(i));
+        }
+        assert(ch.size() == 10000);
+        ch.close();
+        int v;
+        for (int i = 0; i < 10000; ++i)
+        {
+            assert(ch.recv(v) && v == i);
+        }
+        assert(!ch.recv(v)); });
+}
+
+// 多个select挂在相同的两个通道上：每个值恰好被一个select取走；
+// 一个select同时被两个发送方看到时只认领其中一个，另一个发送方继续挂起而不是丢值
+void test_select_claim()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        Channel<int> a;
+        Channel<int> b;
+        const int per_sender = 500;
+        std::atomic<long> sum = {0};
+        std::atomic<int> count = {0};
+        WaitGroup senders;
+        WaitGroup wg;
+        senders.add(4);
+        wg.add(2);
+        for (int i = 0; i < 2; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                for (int k = 1; k <= per_sender; ++k)
+                {
+                    assert(a.send(k));
+                }
+                senders.done(); });
+            iom.scheduleLock([&]()
+                             {
+                for (int k = 1; k <= per_sender; ++k)
+                {
+                    assert(b.send(k));
+                }
+                senders.done(); });
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                while (true)
+                {
+                    int x = 0;
+                    int y = 0;
+                    Select s;
+                    s.recv(a, x).recv(b, y);
+                    int r = s.wait();
+                    if (!s.ok(r))
+                    {
+                        break;
+                    }
+                    sum += r == 0 ? x : y;
+                    ++count;
+                }
+                wg.done(); });
+        }
+        // 无缓冲 -> 发送全部返回时每个值都已经被某个select取走
+        senders.wait();
+        a.close();
+        b.close();
+        wg.wait();
+        assert(count == 4 * per_sender);
+        assert(sum == 4L * per_sender * (per_sender + 1) / 2);
+
+        // 两个发送方都挂起之后，一个select只取走其中一个
+        Channel<int> c;
+        Channel<int> d;
+        std::atomic<int> sent = {0};
+        wg.add(2);
+        iom.scheduleLock([&]()
+                         {
+            assert(c.send(1));
+            ++sent;
+            wg.done(); });
+        iom.scheduleLock([&]()
+                         {
+            assert(d.send(2));
+            ++sent;
+            wg.done(); });
+        usleep(20000);
+        int x = 0;
+        int y = 0;
+        Select s;
+        s.recv(c, x).recv(d, y);
+        int r = s.wait();
+        assert(r == 0 || r == 1);
+        usleep(20000);
+        assert(sent == 1);
+        int rest = 0;
+        assert((r == 0 ? d : c).recv(rest));
+        assert(rest == (r == 0 ? 2 : 1));
+        wg.wait();
+        assert(sent == 2); });
+}
+
+// select超时返回-1，超时之后的发送不会交给已经返回的select；timeout_ms == 0不挂起
+void test_select_timeout()
+{
+    run_in_fiber([](IOManager &)
+                 {
+        Channel<int> ch;
+        int v = 0;
+        Select s;
+        s.recv(ch, v);
+        uint64_t start = now_ms();
+        assert(s.wait(30) == -1);
+        uint64_t elapsed = now_ms() - start;
+        assert(elapsed >= 25 && elapsed < 500);
+
+        int value = 1;
+        assert(!ch.trySend(value));
+
+        Select poll;
+        poll.recv(ch, v);
+        start = now_ms();
+        assert(poll.wait(0) == -1);
+        assert(now_ms() - start < 10);
+
+        // 有值可取 -> 立即返回
+        Channel<int> ready(1);
+        assert(ready.send(5));
+        Select t;
+        t.recv(ch, v).recv(ready, v);
+        assert(t.wait(1000) == 1 && t.ok(1) && v == 5); });
+}
+
+int main()
+{
+    test_rendezvous();
+    test_close_wakes();
+    test_unbounded();
+    test_select_claim();
+    test_select_timeout();
+    std::cout << "test_channel ok" << std::endl;
+    return 0;
+}
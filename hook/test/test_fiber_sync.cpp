@@ -0,0 +1,248 @@
+// 协程同步原语：FiberMutex的互斥与移交、FiberConditionVariable的notify_one/notify_all、FiberSemaphore、写优先的FiberRWLock
+// g++ -std=c++17 -I.. test_fiber_sync.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "fiber_sync.h"
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unistd.h>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 在IOManager上运行f，返回时f已经结束
+template <typename F>
+static void run_in_fiber(F f)
+{
+    IOManager iom(4, false, "fiber_sync");
+    Semaphore done;
+    iom.scheduleLock([&]()
+                     {
+        f(iom);
+        done.signal(); });
+    done.wait();
+}
+
+// 多个工作线程上的协程和一个普通线程竞争同一把锁，持锁期间挂起迫使等待者排队
+void test_mutex_exclusion()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        FiberMutex mutex;
+        long counter = 0;
+        std::atomic<int> inside = {0};
+        WaitGroup wg;
+        wg.add(20);
+        for (int i = 0; i < 20; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                for (int k = 0; k < 500; ++k)
+                {
+                    std::lock_guard<FiberMutex> lock(mutex);
+                    assert(++inside == 1);
+                    long c = counter;
+                    if (k % 100 == 0)
+                    {
+                        usleep(1000);
+                    }
+                    counter = c + 1;
+                    --inside;
+                }
+                wg.done(); });
+        }
+        std::thread t([&]()
+                      {
+            for (int k = 0; k < 10000; ++k)
+            {
+                std::lock_guard<FiberMutex> lock(mutex);
+                assert(++inside == 1);
+                ++counter;
+                --inside;
+            } });
+        wg.wait();
+        t.join();
+        assert(counter == 20 * 500 + 10000); });
+}
+
+// 有协程挂起等待时unlock()直接把锁交给它：解锁方随后的try_lock()失败，等待者不必再竞争
+void test_mutex_handoff()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        FiberMutex mutex;
+        mutex.lock();
+        std::atomic<bool> acquired = {false};
+        Semaphore release;
+        WaitGroup wg;
+        wg.add(1);
+        iom.scheduleLock([&]()
+                         {
+            mutex.lock();
+            acquired = true;
+            release.wait();
+            mutex.unlock();
+            wg.done(); });
+        // 等待者自旋失败之后挂起
+        usleep(50000);
+        assert(!acquired);
+
+        mutex.unlock();
+        assert(!mutex.try_lock());
+        release.signal();
+        wg.wait();
+        assert(acquired);
+        assert(mutex.try_lock());
+        mutex.unlock(); });
+}
+
+// notify_one()只唤醒一个等待者，notify_all()唤醒其余全部
+void test_condition_variable()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        FiberMutex mutex;
+        FiberConditionVariable cv;
+        int tickets = 0;
+        std::atomic<int> woken = {0};
+        WaitGroup wg;
+        wg.add(4);
+        for (int i = 0; i < 4; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                std::unique_lock<FiberMutex> lock(mutex);
+                cv.wait(lock, [&]()
+                        { return tickets > 0; });
+                --tickets;
+                ++woken;
+                wg.done(); });
+        }
+        usleep(30000);
+        assert(woken == 0);
+
+        {
+            std::lock_guard<FiberMutex> lock(mutex);
+            tickets = 1;
+        }
+        cv.notify_one();
+        usleep(30000);
+        assert(woken == 1);
+
+        {
+            std::lock_guard<FiberMutex> lock(mutex);
+            tickets = 3;
+        }
+        cv.notify_all();
+        wg.wait();
+        assert(woken == 4);
+        assert(tickets == 0); });
+}
+
+// 计数为0时挂起，每个signal()放行一个等待者
+void test_semaphore()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        FiberSemaphore sem;
+        assert(!sem.try_wait());
+        std::atomic<int> passed = {0};
+        WaitGroup wg;
+        wg.add(4);
+        for (int i = 0; i < 4; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                sem.wait();
+                ++passed;
+                wg.done(); });
+        }
+        usleep(30000);
+        assert(passed == 0);
+
+        sem.signal();
+        sem.signal();
+        usleep(30000);
+        assert(passed == 2);
+
+        sem.signal();
+        sem.signal();
+        sem.signal();
+        wg.wait();
+        assert(passed == 4);
+        assert(sem.try_wait());
+        assert(!sem.try_wait()); });
+}
+
+// 读者之间并发、与写者互斥；读者源源不断时写者仍能在一个读者持锁周期左右拿到锁
+void test_rwlock_writer_preferred()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        FiberRWLock rw;
+        std::atomic<int> readers = {0};
+        std::atomic<int> max_readers = {0};
+        std::atomic<bool> writing = {false};
+        // 读者最多持续2秒 -> 写者被饿死时测试失败而不是挂住
+        uint64_t deadline = now_ms() + 2000;
+        WaitGroup wg;
+        wg.add(4);
+        for (int i = 0; i < 4; ++i)
+        {
+            iom.scheduleLock([&]()
+                             {
+                while (now_ms() < deadline)
+                {
+                    std::shared_lock<FiberRWLock> lock(rw);
+                    assert(!writing);
+                    int r = ++readers;
+                    if (r > max_readers)
+                    {
+                        max_readers = r;
+                    }
+                    usleep(5000);
+                    --readers;
+                }
+                wg.done(); });
+        }
+        // 读者交替持锁，读锁从不空闲
+        usleep(50000);
+        assert(max_readers > 1);
+
+        uint64_t start = now_ms();
+        {
+            std::unique_lock<FiberRWLock> lock(rw);
+            assert(readers == 0);
+            writing = true;
+            // 持有写锁 -> 新的读者挂起
+            assert(!rw.try_lock_shared());
+            usleep(10000);
+            writing = false;
+        }
+        assert(now_ms() - start < 500);
+
+        wg.wait();
+        assert(rw.try_lock());
+        rw.unlock(); });
+}
+
+int main()
+{
+    test_mutex_exclusion();
+    test_mutex_handoff();
+    test_condition_variable();
+    test_semaphore();
+    test_rwlock_writer_preferred();
+    std::cout << "test_fiber_sync ok" << std::endl;
+    return 0;
+}
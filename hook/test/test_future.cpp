@@ -0,0 +1,159 @@
+// 协程友好的Future/Promise：get()挂起协程、then()衔接、broken_promise
+// g++ -std=c++17 -I.. test_future.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "future.h"
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace sylar;
+
+// 在单线程的IOManager上运行f，返回时f已经结束
+template <typename F>
+static void run_in_fiber(F f)
+{
+    IOManager iom(1, false, "future");
+    Semaphore done;
+    iom.scheduleLock([&]()
+                     {
+        f(iom);
+        done.signal(); });
+    done.wait();
+}
+
+// 唯一的工作线程上get()挂起协程 -> 同一线程上设置结果的任务仍然可以运行
+void test_get_parks_fiber()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        Promise<int> promise;
+        Future<int> future = promise.getFuture();
+        int thread = Thread::GetThreadId();
+        std::atomic<bool> ran = {false};
+        iom.scheduleLock([&]()
+                         {
+            assert(Thread::GetThreadId() == thread);
+            ran = true;
+            promise.setValue(42); });
+
+        assert(!future.isReady());
+        assert(future.get() == 42);
+        assert(ran);
+        assert(!future.valid()); });
+}
+
+// 结果由普通线程设置：挂起的协程通过其调度器恢复
+void test_set_from_thread()
+{
+    run_in_fiber([](IOManager &)
+                 {
+        Promise<void> promise;
+        Future<void> future = promise.getFuture();
+        std::thread t([&]()
+                      {
+            usleep_f(10000);
+            promise.setValue(); });
+        future.get();
+        t.join(); });
+}
+
+// then()：未就绪 -> 在设置结果的执行流中调用；已经就绪 -> 立即调用
+void test_then()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        Promise<std::string> promise;
+        std::atomic<int> calls = {0};
+        Future<size_t> pending = promise.getFuture().then([&](std::string s)
+                                                          {
+            ++calls;
+            return s.size(); });
+        assert(calls == 0);
+        iom.scheduleLock([&]()
+                         {
+            usleep(10000);
+            promise.setValue("hello"); });
+        assert(pending.get() == 5);
+        assert(calls == 1);
+
+        bool ran = false;
+        Future<int> ready = make_ready_future<int>(20).then([&](int v)
+                                                            {
+            ran = true;
+            return v + 1; });
+        assert(ran);
+        assert(ready.isReady());
+        assert(ready.then([](int v)
+                          { return v * 2; })
+                   .get() == 42);
+
+        // 异常跳过then()的函数直接传递
+        Promise<int> failing;
+        bool skipped = true;
+        Future<void> chained = failing.getFuture().then([&](int)
+                                                        { skipped = false; });
+        failing.setException(std::make_exception_ptr(std::runtime_error("bad")));
+        bool thrown = false;
+        try
+        {
+            chained.get();
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        assert(thrown && skipped); });
+}
+
+// Promise未设置结果就析构 -> 挂起在get()上的协程以broken_promise醒来
+void test_broken_promise()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        std::optional<Promise<int>> promise;
+        promise.emplace();
+        Future<int> future = promise->getFuture();
+        iom.scheduleLock([&]()
+                         {
+            usleep(10000);
+            promise.reset(); });
+        bool broken = false;
+        try
+        {
+            future.get();
+        }
+        catch (const std::future_error &e)
+        {
+            broken = e.code() == std::future_errc::broken_promise;
+        }
+        assert(broken);
+
+        Promise<int> twice;
+        twice.setValue(1);
+        bool satisfied = false;
+        try
+        {
+            twice.setValue(2);
+        }
+        catch (const std::future_error &e)
+        {
+            satisfied = e.code() == std::future_errc::promise_already_satisfied;
+        }
+        assert(satisfied); });
+}
+
+int main()
+{
+    test_get_parks_fiber();
+    test_set_from_thread();
+    test_then();
+    test_broken_promise();
+    std::cout << "test_future ok" << std::endl;
+    return 0;
+}
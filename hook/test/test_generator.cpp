@@ -0,0 +1,159 @@
+// 生成器：在调度器的任务协程中消费、提前析构展开生产者、吞掉GeneratorExit的生产者
+// g++ -std=c++17 -I.. test_generator.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "generator.h"
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <csignal>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace sylar;
+
+static Generator<int> range(int n)
+{
+    return Generator<int>([n](Generator<int>::Yield &yield)
+                          {
+        for (int i = 0; i < n; ++i)
+        {
+            yield(i);
+        } });
+}
+
+// 析构时计数
+struct Guard
+{
+    int *count;
+    ~Guard() { ++*count; }
+};
+
+// 消费者是任务协程，在元素之间挂起(可能在另一个工作线程上恢复)；生产者不经过调度器
+void test_consume_in_task()
+{
+    IOManager iom(2, false, "generator");
+    Semaphore done;
+    std::atomic<int> sum = {0};
+    for (int k = 0; k < 4; ++k)
+    {
+        iom.scheduleLock([&]()
+                         {
+            for (int v : range(10))
+            {
+                usleep(1000);
+                sum += v;
+            }
+
+            // 生产者的异常在next()中重新抛出
+            Generator<int> failing([](Generator<int>::Yield &yield)
+                                   {
+                yield(1);
+                throw std::runtime_error("parse"); });
+            bool thrown = false;
+            try
+            {
+                while (failing.next())
+                {
+                    usleep(1000);
+                }
+            }
+            catch (const std::runtime_error &)
+            {
+                thrown = true;
+            }
+            assert(thrown);
+            done.signal(); });
+    }
+    for (int k = 0; k < 4; ++k)
+    {
+        done.wait();
+    }
+    assert(sum == 4 * 45);
+}
+
+// 提前结束遍历 -> 析构时展开生产者的栈
+void test_early_break()
+{
+    int unwound = 0;
+    {
+        Generator<std::string> numbers([&](Generator<std::string>::Yield &yield)
+                                       {
+            Guard guard{&unwound};
+            for (int i = 0;; ++i)
+            {
+                yield(std::to_string(i));
+            } });
+        for (std::string &s : numbers)
+        {
+            if (s == "5")
+            {
+                break;
+            }
+        }
+    }
+    assert(unwound == 1);
+
+    // 只捕获GeneratorExit而不再yield的生产者可以正常结束
+    int cleaned = 0;
+    {
+        Generator<int> g([&](Generator<int>::Yield &yield)
+                         {
+            try
+            {
+                yield(1);
+                yield(2);
+            }
+            catch (const GeneratorExit &)
+            {
+                ++cleaned;
+            } });
+        assert(g.next() && g.value() == 1);
+    }
+    assert(cleaned == 1);
+}
+
+// 吞掉GeneratorExit之后又yield -> terminate而不是永远循环
+void test_swallowed_exit()
+{
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0)
+    {
+        // 不输出terminate的提示
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDERR_FILENO);
+        {
+            Generator<int> g([](Generator<int>::Yield &yield)
+                             {
+                while (true)
+                {
+                    try
+                    {
+                        yield(1);
+                    }
+                    catch (const GeneratorExit &)
+                    {
+                    }
+                } });
+            g.next();
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+
+int main()
+{
+    test_consume_in_task();
+    test_early_break();
+    test_swallowed_exit();
+    std::cout << "test_generator ok" << std::endl;
+    return 0;
+}
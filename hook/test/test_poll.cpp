@@ -0,0 +1,158 @@
+// poll/ppoll/select/epoll_wait钩子：在唯一的工作线程上挂起协程而不是阻塞线程，数据到达时返回，超时返回0
+// g++ -std=c++17 -I.. test_poll.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "ioscheduler.h"
+#include "fiber_sync.h"
+#include "hook.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 四个协程分别用四种调用等待各自的管道，写端协程排在它们之后且在同一个线程上：
+// 钩子阻塞了线程 -> 写端要等到2秒超时之后才能运行
+void test_wake_on_data()
+{
+    int pipes[4][2];
+    for (auto &p : pipes)
+    {
+        assert(pipe(p) == 0);
+    }
+    int idle[2];
+    assert(pipe(idle) == 0);
+    std::atomic<int> ready = {0};
+    {
+        IOManager iom(1, false, "poll");
+        WaitGroup wg;
+        wg.add(5);
+        uint64_t start = now_ms();
+
+        iom.scheduleLock([&]()
+                         {
+            pollfd pfd = {pipes[0][0], POLLIN, 0};
+            assert(poll(&pfd, 1, 2000) == 1);
+            assert(pfd.revents & POLLIN);
+            ++ready;
+            wg.done(); });
+
+        iom.scheduleLock([&]()
+                         {
+            pollfd pfd = {pipes[1][0], POLLIN, 0};
+            timespec ts = {2, 0};
+            assert(ppoll(&pfd, 1, &ts, nullptr) == 1);
+            assert(pfd.revents & POLLIN);
+            ++ready;
+            wg.done(); });
+
+        iom.scheduleLock([&]()
+                         {
+            // 另一个管道没有数据 -> 只报告有数据的那个
+            fd_set rfds;
+            FD_ZERO(&rfds);
+            FD_SET(pipes[2][0], &rfds);
+            FD_SET(idle[0], &rfds);
+            timeval tv = {2, 0};
+            int nfds = std::max(pipes[2][0], idle[0]) + 1;
+            assert(select(nfds, &rfds, nullptr, nullptr, &tv) == 1);
+            assert(FD_ISSET(pipes[2][0], &rfds) && !FD_ISSET(idle[0], &rfds));
+            ++ready;
+            wg.done(); });
+
+        iom.scheduleLock([&]()
+                         {
+            int ep = epoll_create1(0);
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = pipes[3][0];
+            assert(epoll_ctl(ep, EPOLL_CTL_ADD, pipes[3][0], &ev) == 0);
+            epoll_event out[4];
+            assert(epoll_wait(ep, out, 4, 2000) == 1);
+            assert(out[0].data.fd == pipes[3][0]);
+            close(ep);
+            ++ready;
+            wg.done(); });
+
+        iom.scheduleLock([&]()
+                         {
+            usleep(30000);
+            assert(ready == 0);
+            for (auto &p : pipes)
+            {
+                assert(write(p[1], "x", 1) == 1);
+            }
+            wg.done(); });
+
+        wg.wait();
+        assert(ready == 4);
+        assert(now_ms() - start < 1000);
+    }
+    for (auto &p : pipes)
+    {
+        close(p[0]);
+        close(p[1]);
+    }
+    close(idle[0]);
+    close(idle[1]);
+}
+
+// 没有数据 -> 各自在超时之后返回0
+void test_timeout()
+{
+    int p[2];
+    assert(pipe(p) == 0);
+    {
+        IOManager iom(1, false, "poll_timeout");
+        Semaphore done;
+        iom.scheduleLock([&]()
+                         {
+            pollfd pfd = {p[0], POLLIN, 0};
+            uint64_t start = now_ms();
+            assert(poll(&pfd, 1, 50) == 0);
+            assert(now_ms() - start >= 45);
+
+            timespec ts = {0, 50000000};
+            start = now_ms();
+            assert(ppoll(&pfd, 1, &ts, nullptr) == 0);
+            assert(now_ms() - start >= 45);
+
+            fd_set rfds;
+            FD_ZERO(&rfds);
+            FD_SET(p[0], &rfds);
+            timeval tv = {0, 50000};
+            start = now_ms();
+            assert(select(p[0] + 1, &rfds, nullptr, nullptr, &tv) == 0);
+            assert(now_ms() - start >= 45);
+
+            int ep = epoll_create1(0);
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = p[0];
+            epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &ev);
+            epoll_event out[1];
+            start = now_ms();
+            assert(epoll_wait(ep, out, 1, 50) == 0);
+            assert(now_ms() - start >= 45);
+            close(ep);
+            done.signal(); });
+        done.wait();
+    }
+    close(p[0]);
+    close(p[1]);
+}
+
+int main()
+{
+    test_wake_on_data();
+    test_timeout();
+    std::cout << "test_poll ok" << std::endl;
+    return 0;
+}
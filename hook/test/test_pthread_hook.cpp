@@ -0,0 +1,161 @@
+// pthread互斥锁/条件变量钩子
+// g++ -std=c++17 -I.. test_pthread_hook.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "ioscheduler.h"
+#include "hook.h"
+#include "fiber_sync.h"
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace sylar;
+
+// 一个工作线程上的两个协程竞争同一把锁：持有者挂起在usleep上，竞争者挂起而不是阻塞线程
+void test_fiber_contention()
+{
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    std::atomic<int> done = {0};
+    {
+        IOManager iom(1, false, "contention");
+        iom.scheduleLock([&]()
+                         {
+            pthread_mutex_lock(&m);
+            usleep(50000);
+            pthread_mutex_unlock(&m);
+            ++done; });
+        iom.scheduleLock([&]()
+                         {
+            usleep(1000);
+            pthread_mutex_lock(&m);
+            pthread_mutex_unlock(&m);
+            ++done; });
+    }
+    assert(done == 2);
+}
+
+// 线程在pthread_cond_wait()中释放锁(glibc内部解锁，不经过钩子) -> 挂起在这把锁上的协程仍然被唤醒
+void test_thread_cond_wait_release()
+{
+    std::mutex mu;
+    std::condition_variable cv;
+    bool ready = false;
+    std::atomic<bool> parked = {false};
+
+    IOManager iom(1, false, "cond_release");
+    std::unique_lock<std::mutex> lock(mu);
+    iom.scheduleLock([&]()
+                     {
+        parked = true;
+        // 持有者是主线程 -> 挂起
+        std::lock_guard<std::mutex> l(mu);
+        ready = true;
+        cv.notify_one(); });
+    while (!parked)
+    {
+        std::this_thread::yield();
+    }
+    usleep(10000);
+    // 没有唤醒路径时协程永远等不到锁，这里也永远等不到通知
+    cv.wait(lock, [&]()
+            { return ready; });
+    lock.unlock();
+    iom.stop();
+}
+
+// 运行时自身的锁不计入协程持有的锁；trylock与unlock对称 -> 之后的条件变量等待仍然挂起协程
+void test_hooked_lock_count()
+{
+    std::mutex mu;
+    std::condition_variable cv;
+    bool ready = false;
+    std::atomic<int> done = {0};
+    {
+        IOManager iom(1, false, "count");
+        iom.scheduleLock([&]()
+                         {
+            FiberMutex fm;
+            fm.lock();
+            fm.unlock();
+            IOManager::GetThis()->scheduleLock([]() {});
+            pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+            assert(pthread_mutex_trylock(&m) == 0);
+            pthread_mutex_unlock(&m);
+            assert(Scheduler::GetRunningTask()->m_hookedLocks == 0);
+
+            std::unique_lock<std::mutex> l(mu);
+            assert(Scheduler::GetRunningTask()->m_hookedLocks == 1);
+            cv.wait(l, [&]()
+                    { return ready; });
+            ++done; });
+        // 同一个工作线程：等待者阻塞线程时这里无法运行
+        iom.scheduleLock([&]()
+                         {
+            usleep(10000);
+            {
+                std::lock_guard<std::mutex> l(mu);
+                ready = true;
+            }
+            cv.notify_one();
+            ++done; });
+    }
+    assert(done == 2);
+}
+
+// 关闭钩子：挂起的协程被唤醒，改为阻塞线程等锁；关闭期间加锁不计数
+void test_disable()
+{
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    std::atomic<bool> parked = {false};
+    std::atomic<bool> locked = {false};
+
+    IOManager iom(1, false, "disable");
+    pthread_mutex_lock(&m);
+    iom.scheduleLock([&]()
+                     {
+        parked = true;
+        pthread_mutex_lock(&m);
+        locked = true;
+        assert(Scheduler::GetRunningTask()->m_hookedLocks == 0);
+        pthread_mutex_unlock(&m); });
+    while (!parked)
+    {
+        std::this_thread::yield();
+    }
+    usleep(10000);
+    set_pthread_hook_enable(false);
+    usleep(10000);
+    assert(!locked);
+    pthread_mutex_unlock(&m);
+    while (!locked)
+    {
+        std::this_thread::yield();
+    }
+
+    std::atomic<bool> done = {false};
+    iom.scheduleLock([&]()
+                     {
+        pthread_mutex_lock(&m);
+        assert(Scheduler::GetRunningTask()->m_hookedLocks == 0);
+        pthread_mutex_unlock(&m);
+        done = true; });
+    while (!done)
+    {
+        std::this_thread::yield();
+    }
+    iom.stop();
+    set_pthread_hook_enable(true);
+}
+
+int main()
+{
+    set_pthread_hook_enable(true);
+    test_fiber_contention();
+    test_thread_cond_wait_release();
+    test_hooked_lock_count();
+    test_disable();
+    std::cout << "ok" << std::endl;
+    return 0;
+}
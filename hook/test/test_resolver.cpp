@@ -0,0 +1,257 @@
+// 协程DNS解析：本地回环上的DNS桩服务器
+// g++ -std=c++17 -I.. test_resolver.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "ioscheduler.h"
+#include "hook.h"
+#include "resolver.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace sylar;
+
+// 桩服务器的行为
+// ok.test的A记录 -> 1.2.3.4；其他名字 -> NXDOMAIN
+// junk: 每个查询先回一个不足12字节的报文、一个id不对的报文和一个id对但问题中名字不对的报文(地址6.6.6.6)，
+//       正确的应答中问题的名字改为大写
+// mute: 在两个超时内每隔100ms回一个id不对的报文，从不应答
+static std::atomic<bool> s_junk = {false};
+static std::atomic<bool> s_mute = {false};
+static std::atomic<int> s_queries = {0};
+
+static void stub(int fd)
+{
+    uint8_t buf[512];
+    while (true)
+    {
+        sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        ssize_t n = recvfrom_f(fd, buf, sizeof(buf), 0, (sockaddr *)&peer, &len);
+        if (n < 12)
+        {
+            return;
+        }
+        ++s_queries;
+
+        // 问题部分：名字 + 类型 + 类
+        std::string name;
+        size_t pos = 12;
+        while (pos < (size_t)n && buf[pos])
+        {
+            if (!name.empty())
+            {
+                name += '.';
+            }
+            name.append((char *)buf + pos + 1, buf[pos]);
+            pos += buf[pos] + 1;
+        }
+        pos += 1;
+        uint16_t qtype = buf[pos] << 8 | buf[pos + 1];
+        pos += 4;
+
+        if (s_junk || s_mute)
+        {
+            uint8_t shortpkt[4] = {buf[0], buf[1], 0x81, 0x80};
+            sendto_f(fd, shortpkt, sizeof(shortpkt), 0, (sockaddr *)&peer, len);
+            uint8_t wrong[512];
+            memcpy(wrong, buf, pos);
+            wrong[0] ^= 0xff;
+            wrong[2] = 0x81;
+            wrong[3] = 0x80;
+            sendto_f(fd, wrong, pos, 0, (sockaddr *)&peer, len);
+            if (s_junk)
+            {
+                uint8_t spoof[512];
+                memcpy(spoof, buf, pos);
+                spoof[2] = 0x81;
+                spoof[3] = 0x80;
+                memset(spoof + 6, 0, 6);
+                spoof[7] = 1;
+                spoof[13] ^= 0x01;
+                uint8_t rr[] = {0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 6, 6, 6, 6};
+                memcpy(spoof + pos, rr, sizeof(rr));
+                sendto_f(fd, spoof, pos + sizeof(rr), 0, (sockaddr *)&peer, len);
+            }
+            if (s_mute)
+            {
+                for (int i = 0; i < 6; ++i)
+                {
+                    usleep_f(100000);
+                    sendto_f(fd, wrong, pos, 0, (sockaddr *)&peer, len);
+                }
+                continue;
+            }
+        }
+
+        uint8_t reply[512];
+        memcpy(reply, buf, pos);
+        reply[2] = 0x81;
+        reply[3] = 0x80;
+        memset(reply + 6, 0, 6);
+        if (s_junk)
+        {
+            for (size_t i = 13; i < pos - 4; ++i)
+            {
+                reply[i] = toupper(reply[i]);
+            }
+        }
+        size_t end = pos;
+        if (name == "ok.test" && qtype == 1)
+        {
+            reply[7] = 1;
+            // 指向问题中名字的指针，A，IN，TTL 60，1.2.3.4
+            uint8_t rr[] = {0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 1, 2, 3, 4};
+            memcpy(reply + end, rr, sizeof(rr));
+            end += sizeof(rr);
+        }
+        else if (name != "ok.test")
+        {
+            reply[3] = 0x83;
+        }
+        sendto_f(fd, reply, end, 0, (sockaddr *)&peer, len);
+    }
+}
+
+static void write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 在协程中解析，返回错误码
+static int resolve_in_fiber(IOManager &iom, const std::string &host, std::vector<sockaddr_storage> &addrs)
+{
+    std::atomic<int> rt = {-1};
+    std::atomic<bool> done = {false};
+    iom.scheduleLock([&]()
+                     {
+        rt = Resolver::GetInstance()->resolve(host, AF_INET, addrs);
+        done = true; });
+    while (!done)
+    {
+        usleep_f(1000);
+    }
+    return rt;
+}
+
+void test_answers(IOManager &iom)
+{
+    std::vector<sockaddr_storage> addrs;
+    assert(resolve_in_fiber(iom, "ok.test", addrs) == 0);
+    assert(addrs.size() == 1);
+    char text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &((sockaddr_in *)&addrs[0])->sin_addr, text, sizeof(text));
+    assert(strcmp(text, "1.2.3.4") == 0);
+
+    addrs.clear();
+    assert(resolve_in_fiber(iom, "missing.test", addrs) == EAI_NONAME);
+}
+
+// 过短的报文、id不对的报文和问题不对的报文被忽略，不影响随后的应答；问题的名字不区分大小写
+void test_junk(IOManager &iom)
+{
+    Resolver::GetInstance()->clearCache();
+    s_junk = true;
+    std::vector<sockaddr_storage> addrs;
+    assert(resolve_in_fiber(iom, "ok.test", addrs) == 0);
+    assert(addrs.size() == 1);
+    char text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &((sockaddr_in *)&addrs[0])->sin_addr, text, sizeof(text));
+    assert(strcmp(text, "1.2.3.4") == 0);
+    s_junk = false;
+}
+
+// 服务器只回无关的报文 -> 查询在一个超时之内结束，而不是每个报文重新计时
+void test_deadline(IOManager &iom)
+{
+    Resolver::GetInstance()->clearCache();
+    s_mute = true;
+    std::vector<sockaddr_storage> addrs;
+    uint64_t start = now_ms();
+    assert(resolve_in_fiber(iom, "ok.test", addrs) == EAI_AGAIN);
+    uint64_t elapsed = now_ms() - start;
+    assert(elapsed < 300 + 200);
+    s_mute = false;
+}
+
+// search/ndots和NSS来源 -> 交给系统的getaddrinfo()
+void test_can_resolve()
+{
+    Resolver *resolver = Resolver::GetInstance();
+    const char *conf = "/tmp/test_resolver_resolv.conf";
+    const char *nss = "/tmp/test_resolver_nsswitch.conf";
+
+    write_file(conf, "nameserver 127.0.0.1\nsearch corp.example\noptions ndots:2\n");
+    assert(resolver->loadResolvConf(conf));
+    assert(!resolver->canResolve("db"));
+    assert(!resolver->canResolve("db.eu"));
+    assert(resolver->canResolve("db.eu.corp"));
+    assert(resolver->canResolve("db."));
+
+    write_file(conf, "nameserver 127.0.0.1\n");
+    assert(resolver->loadResolvConf(conf));
+    assert(resolver->canResolve("db"));
+
+    write_file(nss, "hosts: files mdns4_minimal [NOTFOUND=return] dns\n");
+    assert(resolver->loadNsswitch(nss));
+    assert(!resolver->canResolve("db.example.com"));
+
+    write_file(nss, "passwd: files systemd\nhosts: files [NOTFOUND=return] dns\n");
+    assert(resolver->loadNsswitch(nss));
+    assert(resolver->canResolve("db.example.com"));
+
+    unlink(conf);
+    unlink(nss);
+}
+
+int main()
+{
+    int fd = socket_f(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    std::thread(stub, fd).detach();
+
+    // 不读取系统配置：hosts为空，只有桩服务器
+    const char *hosts = "/tmp/test_resolver_hosts";
+    write_file(hosts, "");
+    const char *nss = "/tmp/test_resolver_nsswitch.conf";
+    write_file(nss, "hosts: files dns\n");
+    Resolver *resolver = Resolver::GetInstance();
+    resolver->loadHosts(hosts);
+    resolver->loadNsswitch(nss);
+    sockaddr_storage server = {};
+    memcpy(&server, &addr, sizeof(addr));
+    resolver->setNameservers({server});
+    resolver->setTimeout(300, 1);
+    unlink(hosts);
+
+    {
+        IOManager iom(1, false, "resolver");
+        test_answers(iom);
+        test_junk(iom);
+        test_deadline(iom);
+    }
+    test_can_resolve();
+
+    std::cout << "test_resolver ok" << std::endl;
+    return 0;
+}
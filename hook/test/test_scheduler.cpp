@@ -0,0 +1,230 @@
+// 调度器的空闲与伸缩：空闲线程阻塞在FutexEvent上不占CPU且被立即唤醒、自旋/轮询/阻塞各阶段的计数、弹性线程池的扩容与空闲退出
+// g++ -std=c++17 -I.. test_scheduler.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "ioscheduler.h"
+#include "fiber_sync.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <dirent.h>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t cpu_ms()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+// 空闲的工作线程阻塞而不是轮询：空闲期间几乎不占CPU，新任务和stop()都立即唤醒它们
+void test_idle_park()
+{
+    Scheduler sc(3, false, "park");
+    sc.start();
+    usleep(20000);
+
+    uint64_t cpu = cpu_ms();
+    usleep(300000);
+    assert(cpu_ms() - cpu < 30);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        Semaphore ran;
+        uint64_t start = now_ms();
+        sc.scheduleLock([&]()
+                        { ran.signal(); });
+        ran.wait();
+        assert(now_ms() - start < 100);
+        usleep(5000);
+    }
+
+    uint64_t start = now_ms();
+    sc.stop();
+    assert(now_ms() - start < 100);
+}
+
+// 每隔gap_us调度一个空任务并等它运行
+static void trickle(Scheduler &sc, int count, int gap_us)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        Semaphore ran;
+        sc.scheduleLock([&]()
+                        { ran.signal(); });
+        ran.wait();
+        usleep_f(gap_us);
+    }
+}
+
+// 空闲统计按阶段累计：默认直接阻塞，pollCount > 0 -> 阻塞前先轮询，busyPoll -> 从不阻塞；
+// 自旋在单核上被关闭
+void test_idle_counters()
+{
+    {
+        Scheduler sc(1, false, "block");
+        sc.start();
+        trickle(sc, 10, 5000);
+        IdleStats stats = sc.getIdleStats(sc.getThreadIds()[0]);
+        assert(stats.blockWakeups > 0 && stats.blockNs > 0);
+        assert(stats.spinNs == 0 && stats.spinWakeups == 0);
+        assert(stats.pollNs == 0 && stats.pollWakeups == 0);
+        sc.stop();
+
+        // 不是工作线程 -> 全为0
+        stats = sc.getIdleStats(-2);
+        assert(stats.blockWakeups == 0 && stats.blockNs == 0);
+    }
+
+    {
+        IdlePolicy policy;
+        policy.pollCount = 100;
+        IOManager iom(1, false, "poll", policy);
+        trickle(iom, 10, 5000);
+        IdleStats stats = iom.getIdleStats(iom.getThreadIds()[0]);
+        assert(stats.pollNs > 0);
+        // 间隔远大于100次轮询 -> 仍然要阻塞
+        assert(stats.blockWakeups > 0);
+        iom.stop();
+    }
+
+    {
+        IdlePolicy policy;
+        policy.busyPoll = true;
+        Scheduler sc(1, false, "busy");
+        sc.setIdlePolicy(policy);
+        sc.start();
+        trickle(sc, 10, 2000);
+        IdleStats stats = sc.getIdleStats(sc.getThreadIds()[0]);
+        assert(stats.pollWakeups > 0 && stats.pollNs > 0);
+        assert(stats.blockWakeups == 0 && stats.blockNs == 0);
+        sc.stop();
+    }
+
+    {
+        IdlePolicy policy;
+        policy.spinUs = 2000;
+        policy.adaptive = false;
+        Scheduler sc(1, false, "spin");
+        sc.setIdlePolicy(policy);
+        sc.start();
+        trickle(sc, 50, 200);
+        IdleStats stats = sc.getIdleStats(sc.getThreadIds()[0]);
+        if (std::thread::hardware_concurrency() > 1)
+        {
+            assert(stats.spinNs > 0 && stats.spinWakeups > 0);
+        }
+        else
+        {
+            assert(stats.spinNs == 0);
+        }
+        sc.stop();
+    }
+}
+
+// 进程当前的线程数
+static int thread_count()
+{
+    int n = 0;
+    DIR *dir = opendir("/proc/self/task");
+    while (dirent *e = readdir(dir))
+    {
+        if (e->d_name[0] != '.')
+        {
+            ++n;
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+// 任务阻塞住唯一的固定线程 -> 新增弹性线程分担排队的任务；空闲retireAfterMs后退出，
+// 退出之后指定给它的任务交给其他线程
+void test_elastic()
+{
+    Scheduler sc(1, false, "elastic");
+    sc.start();
+    usleep(20000);
+    int fixed = sc.getThreadIds()[0];
+
+    ElasticPolicy policy;
+    policy.maxThreads = 4;
+    policy.growAfterMs = 10;
+    policy.retireAfterMs = 200;
+    sc.setElasticPolicy(policy);
+    // 包括监视线程
+    int base = thread_count();
+
+    std::mutex mutex;
+    std::set<int> seen;
+    std::atomic<int> peak = {0};
+    WaitGroup wg;
+    wg.add(4);
+    uint64_t start = now_ms();
+    for (int i = 0; i < 4; ++i)
+    {
+        // 不经过钩子的阻塞调用，协程无法让出线程
+        sc.scheduleLock([&]()
+                        {
+            usleep_f(200000);
+            int n = thread_count();
+            if (n > peak)
+            {
+                peak = n;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                seen.insert(Thread::GetThreadId());
+            }
+            wg.done(); });
+    }
+    wg.wait();
+    // 只有一个线程时需要800ms
+    assert(now_ms() - start < 600);
+    assert(peak > base && peak <= base + 3);
+    int elastic = -1;
+    for (int id : seen)
+    {
+        if (id != fixed)
+        {
+            elastic = id;
+        }
+    }
+    assert(elastic != -1);
+
+    // 弹性线程空闲之后退出，固定线程保留
+    uint64_t deadline = now_ms() + 2000;
+    while (thread_count() > base && now_ms() < deadline)
+    {
+        usleep(20000);
+    }
+    assert(thread_count() == base);
+
+    Semaphore ran;
+    sc.scheduleLock([&]()
+                    { ran.signal(); },
+                    elastic);
+    ran.wait();
+    sc.stop();
+}
+
+int main()
+{
+    test_idle_park();
+    test_idle_counters();
+    test_elastic();
+    std::cout << "test_scheduler ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,105 @@
+// 基于futex的Semaphore与FutexEvent：多生产者多消费者计数不丢失、等待者返回后立即析构、事件的保留/合并/超时
+// g++ -std=c++17 -I.. test_semaphore.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "thread.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 每个signal()恰好放行一个wait()，结束时计数归零
+void test_counting()
+{
+    Semaphore sem;
+    assert(!sem.tryWait());
+    std::atomic<int> got = {0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&]()
+                             {
+            for (int k = 0; k < 50000; ++k)
+            {
+                sem.wait();
+                ++got;
+            } });
+        threads.emplace_back([&]()
+                             {
+            for (int k = 0; k < 50000; ++k)
+            {
+                sem.signal();
+            } });
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    assert(got == 200000);
+    assert(!sem.tryWait());
+
+    Semaphore initial(2);
+    assert(initial.tryWait());
+    assert(initial.tryWait());
+    assert(!initial.tryWait());
+}
+
+// signal()之后不再访问对象 -> 等待者一返回就可以析构它
+void test_destroy_after_wait()
+{
+    for (int i = 0; i < 20000; ++i)
+    {
+        Semaphore *sem = new Semaphore();
+        std::thread t([sem]()
+                      { sem->signal(); });
+        sem->wait();
+        delete sem;
+        t.join();
+    }
+}
+
+// set()在没有等待者时保留到下一次wait()，多次set()合并为一次；超时返回false
+void test_event()
+{
+    FutexEvent event;
+    uint64_t start = now_ms();
+    assert(!event.wait(30));
+    assert(now_ms() - start >= 25);
+    assert(!event.wait(0));
+
+    event.set();
+    event.set();
+    assert(event.wait(0));
+    assert(!event.wait(0));
+
+    // 阻塞中的线程被唤醒
+    std::atomic<bool> woken = {false};
+    std::thread t([&]()
+                  {
+        assert(event.wait());
+        woken = true; });
+    usleep(20000);
+    assert(!woken);
+    event.set();
+    t.join();
+    assert(woken);
+    assert(!event.wait(0));
+}
+
+int main()
+{
+    test_counting();
+    test_destroy_after_wait();
+    test_event();
+    std::cout << "test_semaphore ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+// 无栈协程适配：Task与有栈协程在同一个IOManager上运行；本文件需要C++20，库本身按C++17编译
+// g++ -std=c++17 -c -I.. $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp)
+// g++ -std=c++20 -Wall -Wextra -I.. test_stackless.cpp *.o -ldl -lpthread
+#include "stackless.h"
+#include "fiber_sync.h"
+
+#include <atomic>
+#include <cassert>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace sylar;
+
+static Task<int> add(int a, int b)
+{
+    co_await sleep_for(5);
+    co_return a + b;
+}
+
+static Task<int> chain()
+{
+    int x = co_await add(1, 2);
+    int y = co_await add(x, 4);
+    co_return y;
+}
+
+static Task<void> boom()
+{
+    co_await sleep_for(1);
+    throw std::runtime_error("boom");
+}
+
+static Task<int> read_byte(int fd, uint64_t timeout_ms)
+{
+    int rt = co_await readable(fd, timeout_ms);
+    if (rt)
+    {
+        co_return errno == ETIMEDOUT ? -2 : -1;
+    }
+    char ch;
+    co_return read(fd, &ch, 1) == 1 ? ch : -1;
+}
+
+static std::atomic<int> s_light = {0};
+
+static Task<void> light()
+{
+    co_await sleep_for(20);
+    ++s_light;
+}
+
+// 嵌套co_await、异常经Future传给有栈协程
+void test_chain(IOManager &iom)
+{
+    assert(co_spawn(&iom, chain()).get() == 7);
+
+    bool thrown = false;
+    try
+    {
+        co_spawn(&iom, boom()).get();
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// 等待fd就绪：数据到达时恢复，超时返回ETIMEDOUT
+void test_readable(IOManager &iom)
+{
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    Future<int> ready = co_spawn(&iom, read_byte(sv[0], (uint64_t)-1));
+    usleep(10000);
+    assert(write(sv[1], "x", 1) == 1);
+    assert(ready.get() == 'x');
+
+    assert(co_spawn(&iom, read_byte(sv[0], 20)).get() == -2);
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+// 大量同时排队的Task：调度队列出队不随队列长度变慢
+void test_many(IOManager &iom)
+{
+    const int count = 100000;
+    std::vector<Future<void>> futures;
+    futures.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        futures.push_back(co_spawn(&iom, light()));
+    }
+    for (Future<void> &f : futures)
+    {
+        f.get();
+    }
+    assert(s_light == count);
+}
+
+int main()
+{
+    IOManager iom(2, false, "stackless");
+    Semaphore done;
+    iom.scheduleLock([&]()
+                     {
+        test_chain(iom);
+        test_readable(iom);
+        test_many(iom);
+        done.signal(); });
+    done.wait();
+    iom.stop();
+
+    std::cout << "test_stackless ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,159 @@
+// 任务组与WaitGroup：错误取消兄弟协程、创建者的令牌取消整个组、析构时等待子协程
+// g++ -std=c++17 -I.. test_task_group.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "task_group.h"
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace sylar;
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 在IOManager上运行f，返回时f已经结束
+template <typename F>
+static void run_in_fiber(F f)
+{
+    IOManager iom(2, false, "task_group");
+    Semaphore done;
+    iom.scheduleLock([&]()
+                     {
+        f(iom);
+        done.signal(); });
+    done.wait();
+}
+
+// 第一个异常取消整个组：挂起在usleep上的兄弟协程以ECANCELED提前返回，wait()重新抛出该异常
+void test_error_cascade()
+{
+    run_in_fiber([](IOManager &)
+                 {
+        std::atomic<int> cancelled = {0};
+        TaskGroup group;
+        for (int i = 0; i < 4; ++i)
+        {
+            group.spawn([&]()
+                        {
+                if (usleep(5000000) == -1 && errno == ECANCELED)
+                {
+                    ++cancelled;
+                } });
+        }
+        group.spawn([]()
+                    {
+            usleep(10000);
+            throw std::runtime_error("boom"); });
+
+        uint64_t start = now_ms();
+        bool thrown = false;
+        try
+        {
+            group.wait();
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(cancelled == 4);
+        assert(group.isCancelled());
+        assert(now_ms() - start < 1000); });
+}
+
+// 创建者自己的令牌被取消 -> 取消整个组
+void test_parent_cancel()
+{
+    run_in_fiber([](IOManager &iom)
+                 {
+        CancelToken::ptr parent = std::make_shared<CancelToken>();
+        CancelToken::SetThis(parent);
+        std::atomic<int> cancelled = {0};
+        {
+            TaskGroup group;
+            for (int i = 0; i < 3; ++i)
+            {
+                group.spawn([&]()
+                            {
+                    if (usleep(5000000) == -1 && errno == ECANCELED)
+                    {
+                        ++cancelled;
+                    } });
+            }
+            iom.addTimer(20, [parent]()
+                         { parent->cancel(); });
+            group.wait();
+            assert(group.isCancelled());
+        }
+        CancelToken::SetThis(nullptr);
+        assert(cancelled == 3);
+
+        // 令牌已经取消 -> 新建的组一开始就是取消状态
+        CancelToken::SetThis(parent);
+        {
+            TaskGroup group;
+            assert(group.isCancelled());
+        }
+        CancelToken::SetThis(nullptr); });
+}
+
+// 没有调用wait() -> 析构时等待所有子协程结束，不抛出异常
+void test_destructor_join()
+{
+    run_in_fiber([](IOManager &)
+                 {
+        std::atomic<int> finished = {0};
+        {
+            TaskGroup group;
+            for (int i = 0; i < 8; ++i)
+            {
+                group.spawn([&]()
+                            {
+                    usleep(20000);
+                    ++finished; });
+            }
+            group.spawn([]()
+                        { throw std::runtime_error("ignored"); });
+        }
+        // 出错取消了其余的子协程，但它们都已经结束
+        assert(finished == 8); });
+}
+
+// WaitGroup：协程与普通线程都可以等待
+void test_wait_group()
+{
+    IOManager iom(2, false, "wait_group");
+    WaitGroup wg;
+    std::atomic<int> count = {0};
+    wg.add(10);
+    for (int i = 0; i < 10; ++i)
+    {
+        iom.scheduleLock([&]()
+                         {
+            usleep(5000);
+            ++count;
+            wg.done(); });
+    }
+    wg.wait();
+    assert(count == 10);
+
+    // 计数为0 -> 立即返回
+    wg.wait();
+}
+
+int main()
+{
+    test_error_cascade();
+    test_parent_cancel();
+    test_destructor_join();
+    test_wait_group();
+    std::cout << "test_task_group ok" << std::endl;
+    return 0;
+}
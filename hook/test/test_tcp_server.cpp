@@ -0,0 +1,182 @@
+// 每个工作线程一个SO_REUSEPORT监听套接字的TcpServer：回环上的连接、fd耗尽时的退避、stop()等待accept协程和处理协程
+// g++ -std=c++17 -I.. test_tcp_server.cpp $(ls ../*.cpp | grep -v -e main.cpp -e preload.cpp) -ldl -lpthread
+#include "tcp_server.h"
+#include "hook.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace sylar;
+
+// 回显一个字节
+class EchoServer : public TcpServer
+{
+public:
+    using TcpServer::TcpServer;
+    ~EchoServer() { stop(); }
+    std::atomic<int> handled = {0};
+
+protected:
+    void handleClient(int client) override
+    {
+        char ch;
+        if (read(client, &ch, 1) == 1)
+        {
+            write(client, &ch, 1);
+        }
+        close(client);
+        ++handled;
+    }
+};
+
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t cpu_ms()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+// 未被占用的回环端口
+static sockaddr_in loopback_addr()
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(::bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    close(fd);
+    return addr;
+}
+
+static int connect_to(const sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool echo(int fd)
+{
+    char ch = 'x';
+    return write(fd, &ch, 1) == 1 && read(fd, &ch, 1) == 1 && ch == 'x';
+}
+
+// 连接分布到各个监听套接字上都被处理；stop()返回时监听套接字已经关闭，处理协程都已结束
+void test_accept()
+{
+    IOManager iom(2, false, "accept");
+    EchoServer server(&iom);
+    sockaddr_in addr = loopback_addr();
+    assert(server.bind((sockaddr *)&addr, sizeof(addr)));
+    assert(server.start());
+
+    for (int i = 0; i < 32; ++i)
+    {
+        int fd = connect_to(addr);
+        assert(fd != -1);
+        assert(echo(fd));
+        close(fd);
+    }
+
+    server.stop();
+    assert(server.handled == 32);
+    assert(connect_to(addr) == -1);
+}
+
+// 客户端连上之后不发送数据 -> stop()取消挂起在read上的处理协程并等待它结束
+void test_stop_handlers()
+{
+    IOManager iom(2, false, "handlers");
+    EchoServer server(&iom);
+    sockaddr_in addr = loopback_addr();
+    assert(server.bind((sockaddr *)&addr, sizeof(addr)));
+    assert(server.start());
+
+    int clients[4];
+    for (int &fd : clients)
+    {
+        fd = connect_to(addr);
+        assert(fd != -1);
+    }
+    usleep(50000);
+    assert(server.handled == 0);
+
+    uint64_t start = now_ms();
+    server.stop();
+    assert(now_ms() - start < 500);
+    assert(server.handled == 4);
+    for (int fd : clients)
+    {
+        close(fd);
+    }
+}
+
+// fd耗尽 -> accept协程退避而不是空转；恢复之后积压的连接被取走，退避中的stop()立即返回
+void test_emfile_backoff()
+{
+    IOManager iom(1, false, "emfile");
+    EchoServer server(&iom);
+    sockaddr_in addr = loopback_addr();
+    assert(server.bind((sockaddr *)&addr, sizeof(addr)));
+    assert(server.start());
+
+    rlimit old_limit;
+    getrlimit(RLIMIT_NOFILE, &old_limit);
+
+    // 客户端占用最小的空闲fd，上限恰好不够accept再取一个；先设置上限，连接一到达accept就会失败
+    int probe = socket(AF_INET, SOCK_STREAM, 0);
+    rlimit limit = old_limit;
+    limit.rlim_cur = probe + 1;
+    close(probe);
+    setrlimit(RLIMIT_NOFILE, &limit);
+    int client = connect_to(addr);
+    assert(client != -1);
+    assert(client == probe);
+    char ch = 'x';
+    assert(write(client, &ch, 1) == 1);
+
+    uint64_t cpu = cpu_ms();
+    usleep(300000);
+    assert(cpu_ms() - cpu < 100);
+    assert(server.handled == 0);
+
+    setrlimit(RLIMIT_NOFILE, &old_limit);
+    assert(read(client, &ch, 1) == 1);
+    close(client);
+
+    // 再次耗尽，然后在退避中停止
+    setrlimit(RLIMIT_NOFILE, &limit);
+    client = connect_to(addr);
+    assert(client != -1);
+    usleep(50000);
+    uint64_t start = now_ms();
+    server.stop();
+    assert(now_ms() - start < 500);
+    setrlimit(RLIMIT_NOFILE, &old_limit);
+    close(client);
+}
+
+int main()
+{
+    test_accept();
+    test_stop_handlers();
+    test_emfile_backoff();
+    std::cout << "test_tcp_server ok" << std::endl;
+    return 0;
+}
@@ -1,12 +1,162 @@
 #include "thread.h"
 
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdexcept>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 namespace sylar
 {
 
+    // 等待者数的单位，见Semaphore::m_data
+    static const uint64_t WAITER = 1ULL << 32;
+
+    // 64位字中低32位所在的地址
+    static int *futex_word(std::atomic<uint64_t> *data)
+    {
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "futex word must be lock-free");
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return reinterpret_cast<int *>(data);
+#else
+        return reinterpret_cast<int *>(data) + 1;
+#endif
+    }
+
+    // 低32位 == val时阻塞，timeout_ms == -1 -> 一直等待
+    static int futex_wait(std::atomic<uint64_t> *data, uint32_t val, int64_t timeout_ms = -1)
+    {
+        timespec ts;
+        timespec *pts = nullptr;
+        if (timeout_ms >= 0)
+        {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000;
+            pts = &ts;
+        }
+        return syscall(SYS_futex, futex_word(data), FUTEX_WAIT_PRIVATE, val, pts, nullptr, 0);
+    }
+
+    // 只用到地址 -> 对象此时可能已经被等待者析构，私有futex的唤醒不访问这块内存
+    static int futex_wake(int *addr, int n)
+    {
+        return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+    }
+
+    bool Semaphore::tryWait()
+    {
+        uint64_t d = m_data.load(std::memory_order_relaxed);
+        while ((uint32_t)d > 0)
+        {
+            if (m_data.compare_exchange_weak(d, d - 1, std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Semaphore::wait()
+    {
+        if (tryWait())
+        {
+            return;
+        }
+
+        // 先登记等待者再检查计数，与signal()的先加计数再检查等待者在同一个字上 -> 不会丢失唤醒
+        uint64_t d = m_data.fetch_add(WAITER) + WAITER;
+        while (true)
+        {
+            if ((uint32_t)d > 0)
+            {
+                // 取走一个计数并注销等待者
+                if (m_data.compare_exchange_weak(d, d - 1 - WAITER, std::memory_order_acquire))
+                {
+                    return;
+                }
+                continue;
+            }
+            futex_wait(&m_data, 0);
+            d = m_data.load();
+        }
+    }
+
+    void Semaphore::signal()
+    {
+        int *addr = futex_word(&m_data);
+        if (m_data.fetch_add(1, std::memory_order_release) >> 32)
+        {
+            futex_wake(addr, 1);
+        }
+    }
+
+    bool FutexEvent::wait(int64_t timeout_ms)
+    {
+        uint64_t d = m_data.load(std::memory_order_relaxed);
+        while ((uint32_t)d == 1)
+        {
+            if (m_data.compare_exchange_weak(d, d - 1, std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+
+        d = m_data.fetch_add(WAITER) + WAITER;
+        bool timedout = false;
+        while (true)
+        {
+            if ((uint32_t)d == 1)
+            {
+                // 消费并注销等待者
+                if (m_data.compare_exchange_weak(d, d - 1 - WAITER, std::memory_order_acquire))
+                {
+                    return true;
+                }
+                continue;
+            }
+            if (timedout)
+            {
+                if (m_data.compare_exchange_weak(d, d - WAITER))
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (futex_wait(&m_data, 0, timeout_ms) == -1 && errno == ETIMEDOUT)
+            {
+                timedout = true;
+            }
+            d = m_data.load();
+        }
+    }
+
+    void FutexEvent::set()
+    {
+        int *addr = futex_word(&m_data);
+        uint64_t d = m_data.load(std::memory_order_relaxed);
+        while (true)
+        {
+            // 已经set -> 等待者不会阻塞在futex上
+            if ((uint32_t)d == 1)
+            {
+                return;
+            }
+            if (m_data.compare_exchange_weak(d, d | 1, std::memory_order_release))
+            {
+                break;
+            }
+        }
+        if (d >> 32)
+        {
+            futex_wake(addr, 1);
+        }
+    }
+
     // 线程信息
     static thread_local Thread *t_thread = nullptr;            // 当前线程的Thread对象指针
     static thread_local std::string t_thread_name = "UNKNOWN"; // 当前线程的名称
@@ -36,6 +186,104 @@ namespace sylar
         t_thread_name = name;
     }
 
+    // 解析"0-3,8,10-11"格式的CPU/节点列表
+    static std::vector<int> parse_cpu_list(const std::string &list)
+    {
+        std::vector<int> ids;
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+            {
+                end = list.size();
+            }
+            std::string range = list.substr(pos, end - pos);
+            pos = end + 1;
+
+            int lo = 0, hi = 0;
+            int n = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+            if (n < 1)
+            {
+                continue;
+            }
+            if (n == 1)
+            {
+                hi = lo;
+            }
+            for (int i = lo; i <= hi; ++i)
+            {
+                ids.push_back(i);
+            }
+        }
+        return ids;
+    }
+
+    bool Thread::SetAffinity(const std::vector<int> &cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+        int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rt)
+        {
+            std::cerr << "pthread_setaffinity_np failed, rt=" << rt << " name=" << t_thread_name << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<std::vector<int>> Thread::GetNumaNodes()
+    {
+        std::vector<std::vector<int>> nodes;
+
+        std::string online;
+        std::ifstream in("/sys/devices/system/node/online");
+        if (!std::getline(in, online))
+        {
+            return nodes;
+        }
+
+        // 只保留本进程可以使用的CPU(taskset/cgroup cpuset)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        {
+            return nodes;
+        }
+
+        for (int node : parse_cpu_list(online))
+        {
+            std::string cpulist;
+            std::ifstream node_in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!std::getline(node_in, cpulist))
+            {
+                continue;
+            }
+
+            std::vector<int> cpus;
+            for (int cpu : parse_cpu_list(cpulist))
+            {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            // 没有CPU的节点(只有内存)不参与分配
+            if (!cpus.empty())
+            {
+                nodes.push_back(cpus);
+            }
+        }
+        return nodes;
+    }
+
     Thread::Thread(std::function<void()> cb, const std::string &name) : m_cb(cb), m_name(name)
     {
         int rt = pthread_create(&m_thread, nullptr, &Thread::run, this);
@@ -1,43 +1,47 @@
 #ifndef _THREAD_H_
 #define _THREAD_H_
 
-#include <condition_variable>
+#include <atomic>
+#include <cstdint>
 #include <functional>
-#include <mutex>
+#include <string>
+#include <vector>
 
 namespace sylar
 {
 
-    // 用于线程方法间的同步
+    // 用于线程方法间的同步，基于futex：无竞争时只有一次原子操作，没有等待者时signal()不进入内核
+    // 计数与等待者数放在同一个64位字中 -> signal()只做一次原子操作，之后不再访问本对象，等待者返回后可以立即析构它
     class Semaphore
     {
     public:
         // 信号量初始化为0
-        explicit Semaphore(int count_ = 0) : count(count_) {}
+        explicit Semaphore(int count_ = 0) : m_data((uint32_t)count_) {}
 
         // P操作
-        void wait()
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            while (count == 0)
-            {
-                cv.wait(lock); // wait for signals
-            }
-            count--;
-        }
+        void wait();
+        bool tryWait();
 
         // V操作
-        void signal()
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            count++;
-            cv.notify_one(); // signal
-        }
+        void signal();
 
     private:
-        std::mutex mtx;
-        std::condition_variable cv;
-        int count;
+        // 低32位: 计数，futex等待在这一半上；高32位: 阻塞在futex上的线程数
+        std::atomic<uint64_t> m_data;
+    };
+
+    // 线程事件：set()唤醒一个wait()中的线程，没有等待者时保留到下一次wait()，被消费后自动复位
+    // 用于工作线程的休眠/唤醒
+    class FutexEvent
+    {
+    public:
+        // timeout_ms == -1 -> 一直等待，返回是否被set()唤醒
+        bool wait(int64_t timeout_ms = -1);
+        void set();
+
+    private:
+        // 低32位: 1 -> 已set，尚未被消费；高32位: 等待者数，与Semaphore相同
+        std::atomic<uint64_t> m_data = {0};
     };
 
     // 一共两种线程: 1 由系统自动创建的主线程 2 由Thread类创建的线程
@@ -63,6 +67,11 @@ namespace sylar
         // 设置当前线程的名字
         static void SetName(const std::string &name);
 
+        // 把当前线程绑定到cpus中的CPU上，成功返回true
+        static bool SetAffinity(const std::vector<int> &cpus);
+        // 每个NUMA节点上本进程可以使用的CPU，读取失败时为空
+        static std::vector<std::vector<int>> GetNumaNodes();
+
     private:
         // 线程函数
         static void *run(void *arg);